@@ -0,0 +1,40 @@
+TEMPLATE = app
+TARGET = uglylab_bench
+
+CONFIG += console c++17
+CONFIG -= qt app_bundle
+
+# The benchmark compiles the engine sources directly and replaces the
+# viewer's shared memory segments with in-process fakes, so it runs
+# without a viewer and without Qt.
+INCLUDEPATH += $$PWD
+DEFINES += UGLYLAB_TRACK_ALLOCATIONS
+
+SOURCES += \
+    bench/benchmain.cpp \
+    parallel.cpp \
+    profiler.cpp \
+    rule.cpp \
+    world.cpp
+
+HEADERS += \
+    activeset.h \
+    agentlod.h \
+    coupling.h \
+    fieldstore.h \
+    grid.h \
+    grid3d.h \
+    ispecies.h \
+    memorypolicy.h \
+    observables.h \
+    parallel.h \
+    profiler.h \
+    reductions.h \
+    rule.h \
+    sparsegrid3d.h \
+    species.h \
+    uglylab_sharedmemory.h \
+    vec3.h \
+    world.h
+
+LIBS += -pthread
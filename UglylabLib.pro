@@ -9,18 +9,36 @@ CONFIG += c++17
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+# Count heap allocations per step in the profiler stats (replaces global operator new).
+#DEFINES += UGLYLAB_TRACK_ALLOCATIONS
+
 SOURCES += \
+    parallel.cpp \
+    profiler.cpp \
     rule.cpp \
     simulator.cpp \
+    transport.cpp \
     world.cpp
 
 HEADERS += \
+    activeset.h \
+    agentlod.h \
+    coupling.h \
+    decomposition.h \
+    fieldstore.h \
     grid.h \
     grid3d.h \
     ispecies.h \
+    memorypolicy.h \
+    observables.h \
+    parallel.h \
+    profiler.h \
+    reductions.h \
     rule.h \
     simulator.h \
+    sparsegrid3d.h \
     species.h \
+    transport.h \
     uglylab_sharedmemory.h \
     vec3.h \
     world.h
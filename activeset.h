@@ -0,0 +1,157 @@
+#ifndef ACTIVESET_H
+#define ACTIVESET_H
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "grid3d.h"
+#include "parallel.h"
+
+// Sparse scheduling of cellular automaton updates.
+//
+// The domain is cut into cubic bricks (8^3 cells by default). Cells that
+// changed during a step are reported with markChanged(); the bricks holding
+// them and their 3x3x3 neighbourhood become the active set of the next step
+// after advance(). Rules then visit only the active bricks, so a propagating
+// front costs work proportional to its surface rather than to the volume.
+//
+//   ActiveSet active(grid.getXSize(), grid.getYSize(), grid.getZSize());
+//   active.activateAll();  // everything may change on the first step
+//   // every step:
+//   active.advance();
+//   updateActiveCells(*current, *next, active, [&](int x, int y, int z, const Grid3D<float>& g) { ... });
+//   std::swap(current, next);
+class ActiveSet {
+public:
+    ActiveSet(int xSize, int ySize, int zSize, int brickSize = 8)
+        : xSize(xSize), ySize(ySize), zSize(zSize), brickSize(std::max(1, brickSize)) {
+        bricks[0] = (xSize + this->brickSize - 1) / this->brickSize;
+        bricks[1] = (ySize + this->brickSize - 1) / this->brickSize;
+        bricks[2] = (zSize + this->brickSize - 1) / this->brickSize;
+        flags.reset(new std::atomic<unsigned char>[getBrickCount()]);
+        for (size_t b = 0; b < getBrickCount(); ++b)
+            flags[b].store(0, std::memory_order_relaxed);
+    }
+
+    int getBrickSize() const { return brickSize; }
+    size_t getBrickCount() const {
+        return static_cast<size_t>(bricks[0]) * static_cast<size_t>(bricks[1]) * static_cast<size_t>(bricks[2]);
+    }
+
+    // Reports that cell (x, y, z) changed: it and its neighbours are visited
+    // next step. Safe to call concurrently from a parallel sweep.
+    void markChanged(int x, int y, int z) {
+        const int lo[3] = {std::max(x - 1, 0) / brickSize, std::max(y - 1, 0) / brickSize,
+                           std::max(z - 1, 0) / brickSize};
+        const int hi[3] = {std::min(x + 1, xSize - 1) / brickSize, std::min(y + 1, ySize - 1) / brickSize,
+                           std::min(z + 1, zSize - 1) / brickSize};
+        for (int bz = lo[2]; bz <= hi[2]; ++bz)
+            for (int by = lo[1]; by <= hi[1]; ++by)
+                for (int bx = lo[0]; bx <= hi[0]; ++bx) {
+                    std::atomic<unsigned char>& flag = flags[brickIndex(bx, by, bz)];
+                    if (!flag.load(std::memory_order_relaxed))  // avoid bouncing hot cache lines
+                        flag.store(1, std::memory_order_relaxed);
+                }
+    }
+
+    // Makes every brick active on the next advance(), e.g. for the first step
+    // or after a rule rewrote the grid wholesale.
+    void activateAll() {
+        for (size_t b = 0; b < getBrickCount(); ++b)
+            flags[b].store(1, std::memory_order_relaxed);
+    }
+
+    // Turns the bricks marked since the last call into the active set and
+    // clears the marks. Returns the number of active bricks.
+    size_t advance() {
+        const int workers = WorkerPool::instance().size();
+        std::vector<std::vector<int>> partial(workers);
+        WorkerPool::instance().run([&](int worker) {
+            size_t begin, end;
+            workerRange(0, getBrickCount(), worker, workers, begin, end);
+            for (size_t b = begin; b < end; ++b)
+                if (flags[b].exchange(0, std::memory_order_relaxed))
+                    partial[worker].push_back(static_cast<int>(b));
+        });
+
+        active.clear();
+        for (const std::vector<int>& part : partial)
+            active.insert(active.end(), part.begin(), part.end());
+        return active.size();
+    }
+
+    size_t activeBrickCount() const { return active.size(); }
+    const std::vector<int>& activeBricks() const { return active; }
+
+    // Calls func(x, y, z, cell) for every cell of the active bricks, in
+    // parallel over bricks; `cell` is the Grid3D linear index. Writes must
+    // stay within the visited cell.
+    template<typename Func>
+    void forEachActiveCell(Func&& func) const {
+        parallelFor(0, active.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                forEachCellInBrick(active[i], func);
+        }, 1);
+    }
+
+    // Calls func(x, y, z, cell) for the cells of one brick, clipped to the grid.
+    template<typename Func>
+    void forEachCellInBrick(int brick, Func&& func) const {
+        const int x0 = (brick % bricks[0]) * brickSize;
+        const int y0 = ((brick / bricks[0]) % bricks[1]) * brickSize;
+        const int z0 = (brick / (bricks[0] * bricks[1])) * brickSize;
+        const int x1 = std::min(x0 + brickSize, xSize);
+        const int y1 = std::min(y0 + brickSize, ySize);
+        const int z1 = std::min(z0 + brickSize, zSize);
+        for (int z = z0; z < z1; ++z)
+            for (int y = y0; y < y1; ++y) {
+                size_t cell = static_cast<size_t>(x0) + static_cast<size_t>(xSize) *
+                              (y + static_cast<size_t>(ySize) * z);
+                for (int x = x0; x < x1; ++x, ++cell)
+                    func(x, y, z, cell);
+            }
+    }
+
+private:
+    int xSize, ySize, zSize;
+    int brickSize;
+    int bricks[3];
+    std::unique_ptr<std::atomic<unsigned char>[]> flags;  // marked for the next step
+    std::vector<int> active;                               // bricks of the current step
+
+    size_t brickIndex(int bx, int by, int bz) const {
+        return static_cast<size_t>(bx) + static_cast<size_t>(bricks[0]) *
+               (static_cast<size_t>(by) + static_cast<size_t>(bricks[1]) * bz);
+    }
+};
+
+// One double-buffered CA step over the active set: for every active cell,
+// next(x,y,z) = rule(x, y, z, current), and cells whose value changed are
+// marked for the following step. Inactive cells are not written, which is
+// correct as long as both grids start out identical: a cell that changed
+// last step is always active, so the stale buffer is brought up to date
+// before it is read again. Returns the number of changed cells.
+template<typename T, int X, int Y, int Z, typename Rule>
+size_t updateActiveCells(const Grid3D<T, X, Y, Z>& current, Grid3D<T, X, Y, Z>& next, ActiveSet& set, Rule&& rule) {
+    const T* in = current.rawData();
+    T* out = next.rawData();
+    const std::vector<int>& bricks = set.activeBricks();
+    std::atomic<size_t> changed{0};
+    parallelFor(0, bricks.size(), [&](size_t begin, size_t end) {
+        size_t local = 0;
+        for (size_t i = begin; i < end; ++i)
+            set.forEachCellInBrick(bricks[i], [&](int x, int y, int z, size_t cell) {
+                const T value = rule(x, y, z, current);
+                out[cell] = value;
+                if (!(value == in[cell])) {
+                    set.markChanged(x, y, z);
+                    ++local;
+                }
+            });
+        changed.fetch_add(local, std::memory_order_relaxed);
+    }, 1);
+    return changed.load();
+}
+
+#endif // ACTIVESET_H
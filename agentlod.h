@@ -0,0 +1,289 @@
+#ifndef AGENTLOD_H
+#define AGENTLOD_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "parallel.h"
+#include "uglylab_sharedmemory.h"
+
+// Level-of-detail reduction and publishing of the agent stream, driven by
+// the agentFormat / agentLodBudget / agentLodMode fields of CommandBuffer.
+
+struct AgentStreamSettings {
+    int format = AGENT_FORMAT_FLOAT;
+    int budget = 0;                   // 0 = publish every agent
+    int lodMode = AGENT_LOD_SUBSAMPLE;
+};
+
+inline AgentStreamSettings agentStreamSettings(const CommandBuffer* cmd) {
+    AgentStreamSettings settings;
+    if (cmd) {
+        settings.format = cmd->agentFormat.load();
+        settings.budget = cmd->agentLodBudget.load();
+        settings.lodMode = cmd->agentLodMode.load();
+    }
+    return settings;
+}
+
+// Axis-aligned bounding box of the agents (all zero when empty).
+inline void agentBounds(const std::vector<AgentData>& agents, float boundsMin[3], float boundsMax[3]) {
+    const int workers = WorkerPool::instance().size();
+    std::vector<float> partial(static_cast<size_t>(workers) * 6);
+    for (int w = 0; w < workers; ++w) {
+        float* p = &partial[static_cast<size_t>(w) * 6];
+        p[0] = p[1] = p[2] = std::numeric_limits<float>::max();
+        p[3] = p[4] = p[5] = std::numeric_limits<float>::lowest();
+    }
+
+    WorkerPool::instance().run([&](int worker) {
+        size_t begin, end;
+        workerRange(0, agents.size(), worker, workers, begin, end);
+        float* p = &partial[static_cast<size_t>(worker) * 6];
+        for (size_t i = begin; i < end; ++i) {
+            const AgentData& a = agents[i];
+            p[0] = std::min(p[0], a.x); p[3] = std::max(p[3], a.x);
+            p[1] = std::min(p[1], a.y); p[4] = std::max(p[4], a.y);
+            p[2] = std::min(p[2], a.z); p[5] = std::max(p[5], a.z);
+        }
+    });
+
+    for (int a = 0; a < 3; ++a) {
+        boundsMin[a] = std::numeric_limits<float>::max();
+        boundsMax[a] = std::numeric_limits<float>::lowest();
+        for (int w = 0; w < workers; ++w) {
+            boundsMin[a] = std::min(boundsMin[a], partial[static_cast<size_t>(w) * 6 + a]);
+            boundsMax[a] = std::max(boundsMax[a], partial[static_cast<size_t>(w) * 6 + 3 + a]);
+        }
+        if (agents.empty()) boundsMin[a] = boundsMax[a] = 0.0f;
+    }
+}
+
+namespace agentlod_detail {
+
+// Sorts agent indices by the coarse cell (resolution^3 cells over the bounds)
+// they fall in. parallelCountingSort() keeps workers x buckets counters, so
+// the cell ids are sorted as an LSD radix sort whose digits are as wide as
+// MAX_SORT_COUNTERS allows: one pass with few workers, two or three with
+// many, instead of a counter table that grows with workers x cells.
+inline void sortByCoarseCell(const std::vector<AgentData>& agents, int resolution,
+                             const float boundsMin[3], const float boundsMax[3],
+                             std::vector<size_t>& order, std::vector<size_t>& cellStart) {
+    constexpr size_t MAX_SORT_COUNTERS = size_t(1) << 20;  // 8 MB of counters
+    float scale[3];
+    for (int a = 0; a < 3; ++a) {
+        const float extent = boundsMax[a] - boundsMin[a];
+        scale[a] = extent > 0.0f ? resolution / extent : 0.0f;
+    }
+    auto axisCell = [resolution](float v) {
+        const int c = static_cast<int>(v);
+        return c < 0 ? 0 : (c >= resolution ? resolution - 1 : c);
+    };
+
+    const size_t n = agents.size();
+    std::vector<int> cellOf(n);
+    parallelFor(0, n, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const AgentData& a = agents[i];
+            const int cx = axisCell((a.x - boundsMin[0]) * scale[0]);
+            const int cy = axisCell((a.y - boundsMin[1]) * scale[1]);
+            const int cz = axisCell((a.z - boundsMin[2]) * scale[2]);
+            cellOf[i] = cx + resolution * (cy + resolution * cz);
+        }
+    });
+
+    const int cells = resolution * resolution * resolution;
+    int keyBits = 0;
+    while ((cells - 1) >> keyBits) ++keyBits;
+    int digitBits = 8;
+    while ((MAX_SORT_COUNTERS >> (digitBits + 1)) >= static_cast<size_t>(WorkerPool::instance().size()))
+        ++digitBits;
+    const int passes = std::max(1, (keyBits + digitBits - 1) / digitBits);
+    if (passes == 1) {
+        parallelCountingSort(cellOf, cells - 1, order, cellStart);
+        return;
+    }
+
+    digitBits = (keyBits + passes - 1) / passes;
+    const int digitMask = (1 << digitBits) - 1;
+    std::vector<int> digit(n);
+    std::vector<size_t> passOrder, passStart, next(n);
+    for (int pass = 0; pass < passes; ++pass) {
+        const int shift = pass * digitBits;
+        parallelFor(0, n, [&](size_t begin, size_t end) {
+            for (size_t j = begin; j < end; ++j)
+                digit[j] = (cellOf[pass == 0 ? j : order[j]] >> shift) & digitMask;
+        });
+        parallelCountingSort(digit, digitMask, passOrder, passStart);
+        if (pass == 0) {
+            order.swap(passOrder);
+            continue;
+        }
+        parallelFor(0, n, [&](size_t begin, size_t end) {
+            for (size_t j = begin; j < end; ++j)
+                next[j] = order[passOrder[j]];
+        });
+        order.swap(next);
+    }
+
+    // cellStart[c] is the first sorted position whose cell is >= c.
+    cellStart.assign(static_cast<size_t>(cells) + 1, n);
+    parallelFor(0, n, [&](size_t begin, size_t end) {
+        for (size_t j = begin; j < end; ++j) {
+            const int cell = cellOf[order[j]];
+            const int previous = j == 0 ? -1 : cellOf[order[j - 1]];
+            for (int c = previous + 1; c <= cell; ++c)
+                cellStart[c] = j;
+        }
+    });
+}
+
+inline void subsample(const std::vector<AgentData>& agents, size_t budget,
+                      const float boundsMin[3], const float boundsMax[3],
+                      std::vector<AgentData>& out, std::vector<uint32_t>& weights) {
+    // Systematic sampling along the cell-sorted order: record k stands for
+    // the stratum [k * n / budget, (k + 1) * n / budget) of that order, so
+    // every coarse cell keeps a share of the budget proportional to its
+    // population and the weights add up to n exactly.
+    constexpr int STRATA_RESOLUTION = 32;
+    std::vector<size_t> order, cellStart;
+    sortByCoarseCell(agents, STRATA_RESOLUTION, boundsMin, boundsMax, order, cellStart);
+
+    const size_t n = agents.size();
+    out.resize(budget);
+    weights.resize(budget);
+    parallelFor(0, budget, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            const size_t lo = k * n / budget;
+            const size_t hi = (k + 1) * n / budget;
+            out[k] = agents[order[lo + (hi - lo) / 2]];
+            weights[k] = static_cast<uint32_t>(hi - lo);
+        }
+    });
+}
+
+inline void aggregate(const std::vector<AgentData>& agents, int resolution,
+                      const float boundsMin[3], const float boundsMax[3],
+                      std::vector<AgentData>& out, std::vector<uint32_t>& weights) {
+    std::vector<size_t> order, cellStart;
+    sortByCoarseCell(agents, resolution, boundsMin, boundsMax, order, cellStart);
+
+    struct Accumulator {
+        int species;
+        double x, y, z;
+        uint32_t count;
+    };
+
+    const int workers = WorkerPool::instance().size();
+    const size_t cells = static_cast<size_t>(resolution) * resolution * resolution;
+    std::vector<std::vector<AgentData>> partOut(workers);
+    std::vector<std::vector<uint32_t>> partWeights(workers);
+
+    WorkerPool::instance().run([&](int worker) {
+        size_t begin, end;
+        workerRange(0, cells, worker, workers, begin, end);
+        std::vector<Accumulator> perSpecies;
+        for (size_t cell = begin; cell < end; ++cell) {
+            perSpecies.clear();
+            for (size_t o = cellStart[cell]; o < cellStart[cell + 1]; ++o) {
+                const AgentData& a = agents[order[o]];
+                auto it = std::find_if(perSpecies.begin(), perSpecies.end(),
+                                       [&](const Accumulator& acc) { return acc.species == a.species_id; });
+                if (it == perSpecies.end()) {
+                    perSpecies.push_back({a.species_id, 0.0, 0.0, 0.0, 0});
+                    it = perSpecies.end() - 1;
+                }
+                it->x += a.x; it->y += a.y; it->z += a.z;
+                ++it->count;
+            }
+            for (const Accumulator& acc : perSpecies) {
+                partOut[worker].push_back({static_cast<float>(acc.x / acc.count),
+                                           static_cast<float>(acc.y / acc.count),
+                                           static_cast<float>(acc.z / acc.count),
+                                           acc.species});
+                partWeights[worker].push_back(acc.count);
+            }
+        }
+    });
+
+    out.clear();
+    weights.clear();
+    for (int w = 0; w < workers; ++w) {
+        out.insert(out.end(), partOut[w].begin(), partOut[w].end());
+        weights.insert(weights.end(), partWeights[w].begin(), partWeights[w].end());
+    }
+}
+
+} // namespace agentlod_detail
+
+// Reduces `agents` to at most `budget` records: a spatially stratified
+// subsample, or per-cell/per-species centroids on a coarse grid sized to the
+// budget. `weights` receives how many agents each record stands for.
+inline void reduceAgentsToBudget(const std::vector<AgentData>& agents, size_t budget, int lodMode,
+                                 const float boundsMin[3], const float boundsMax[3],
+                                 std::vector<AgentData>& out, std::vector<uint32_t>& weights) {
+    if (lodMode != AGENT_LOD_AGGREGATE) {
+        agentlod_detail::subsample(agents, budget, boundsMin, boundsMax, out, weights);
+        return;
+    }
+
+    int resolution = std::clamp(static_cast<int>(std::cbrt(static_cast<double>(budget))), 1, 64);
+    while (true) {
+        agentlod_detail::aggregate(agents, resolution, boundsMin, boundsMax, out, weights);
+        if (out.size() <= budget || resolution == 1) break;
+        resolution = resolution * 3 / 4;  // several species per cell: coarsen and retry
+    }
+    // More species than budget even in a single cell: centroids cannot fit,
+    // so fall back to the subsample, whose weights still cover every agent.
+    if (out.size() > budget)
+        agentlod_detail::subsample(agents, budget, boundsMin, boundsMax, out, weights);
+}
+
+// Publishes the agents in the format and LOD budget requested by the viewer.
+// Bounds are used for quantization and stratification; pass the domain
+// extent when known, otherwise agentBounds(). A subsample is published in
+// the requested format with a uniform AgentFrameInfo::record_weight.
+// Aggregated centroids carry their own counts, so they are always published
+// as a weighted quantized frame. Returns the bytes written, 0 if the frame
+// was not published.
+inline long long writeAgentStream(SharedBuffer* buffer, const std::vector<AgentData>& agents,
+                                  const AgentStreamSettings& settings,
+                                  const float boundsMin[3], const float boundsMax[3], int frame_index) {
+    const bool overBudget = settings.budget > 0 && agents.size() > static_cast<size_t>(settings.budget);
+
+    if (!overBudget) {
+        if (settings.format == AGENT_FORMAT_QUANTIZED16) {
+            if (!writeAgentsQuantizedPaged(buffer, agents, {}, boundsMin, boundsMax,
+                                           frame_index, static_cast<int>(agents.size())))
+                return 0;
+            return static_cast<long long>(agents.size() * sizeof(QuantizedAgentData));
+        }
+        if (!writeAgentsPaged(buffer, agents, frame_index)) return 0;
+        return static_cast<long long>(agents.size() * sizeof(AgentData));
+    }
+
+    std::vector<AgentData> reduced;
+    std::vector<uint32_t> weights;
+    reduceAgentsToBudget(agents, static_cast<size_t>(settings.budget), settings.lodMode,
+                         boundsMin, boundsMax, reduced, weights);
+    const int population = static_cast<int>(agents.size());
+
+    if (settings.lodMode == AGENT_LOD_AGGREGATE) {
+        if (!writeAgentsQuantizedPaged(buffer, reduced, weights, boundsMin, boundsMax, frame_index, population))
+            return 0;
+        return static_cast<long long>(reduced.size() * (sizeof(QuantizedAgentData) + sizeof(uint32_t)));
+    }
+
+    if (settings.format == AGENT_FORMAT_QUANTIZED16) {
+        if (!writeAgentsQuantizedPaged(buffer, reduced, {}, boundsMin, boundsMax, frame_index, population))
+            return 0;
+        return static_cast<long long>(reduced.size() * sizeof(QuantizedAgentData));
+    }
+
+    if (!writeAgentsPaged(buffer, reduced, frame_index, population)) return 0;
+    return static_cast<long long>(reduced.size() * sizeof(AgentData));
+}
+
+#endif // AGENTLOD_H
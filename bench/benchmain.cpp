@@ -0,0 +1,302 @@
+// Throughput benchmarks for the per-step hot paths of the engine.
+// Parallel kernels use UGLYLAB_THREADS workers (default: all cores).
+//
+// Every measurement is printed as one JSON object per line on stdout so the
+// results can be diffed between releases:
+//   {"phase":"snapshot","agents":1000000,"iterations":12,"ns_per_iter":...,
+//    "items_per_sec":...,"allocs_per_iter":...,"bytes_per_iter":...}
+//
+// Usage: uglylab_bench [--agents-min N] [--agents-max N]
+//                      [--grid-min N] [--grid-max N] [--min-time SECONDS]
+
+#include "agentlod.h"
+#include "coupling.h"
+#include "grid3d.h"
+#include "profiler.h"
+#include "reductions.h"
+#include "species.h"
+#include "uglylab_sharedmemory.h"
+#include "world.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// ---------- In-process fake of the shm segments ----------
+// Anonymous mappings behave like the viewer-created segments (zeroed, lazily
+// committed) without touching /dev/shm.
+static void* fakeSegment(size_t bytes) {
+    void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED) {
+        perror("mmap (bench segment)");
+        return nullptr;
+    }
+    return ptr;
+}
+
+// ---------- Synthetic world ----------
+struct BenchAgent : public Species<BenchAgent> {
+    static constexpr int SpeciesID = 0;
+    float uptake = 0.0f;
+    BenchAgent(float x, float y, float z) : Species(x, y, z) {}
+};
+
+class RandomWalkRule : public Rule {
+public:
+    explicit RandomWalkRule(float extent) : extent(extent) {}
+
+    void execute() override {
+        for (BenchAgent* agent : BenchAgent::agents) {
+            Vec3& p = *agent->position;
+            p.x = wrap(p.x + nextStep());
+            p.y = wrap(p.y + nextStep());
+            p.z = wrap(p.z + nextStep());
+        }
+    }
+
+private:
+    float extent;
+    uint32_t state = 12345u;
+
+    float nextStep() {
+        state = state * 1664525u + 1013904223u;
+        return (static_cast<float>(state >> 8) / 16777216.0f - 0.5f);
+    }
+
+    float wrap(float v) const {
+        if (v < 0.0f) return v + extent;
+        if (v >= extent) return v - extent;
+        return v;
+    }
+};
+
+class BenchWorld : public World {
+public:
+    long long agentTarget = 0;
+    float extent = 100.0f;
+
+    void initialize() override {
+        new RandomWalkRule(extent);
+        uint32_t state = 987654321u;
+        auto uniform = [&]() {
+            state = state * 1664525u + 1013904223u;
+            return static_cast<float>(state >> 8) / 16777216.0f * extent;
+        };
+        BenchAgent::addAgents(static_cast<int>(agentTarget), {uniform, uniform, uniform});
+    }
+};
+
+// ---------- Measurement ----------
+struct Options {
+    long long agentsMin = 1000;
+    long long agentsMax = 10000000;
+    int gridMin = 64;
+    int gridMax = 512;
+    double minTime = 0.5;
+};
+
+static Options options;
+
+template<typename Func>
+static void measure(const char* phase, const char* sizeKey, long long size,
+                    double itemsPerIter, Func&& func) {
+    func();  // warm-up: first touch of buffers, page faults
+
+    using Clock = std::chrono::steady_clock;
+    const AllocationStats allocsBefore = allocationStats();
+    const auto start = Clock::now();
+
+    long long iterations = 0;
+    double elapsed = 0.0;
+    do {
+        func();
+        ++iterations;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < options.minTime || iterations < 3);
+
+    const AllocationStats allocsAfter = allocationStats();
+    const double allocs = static_cast<double>(allocsAfter.count - allocsBefore.count) / iterations;
+    const double bytes = static_cast<double>(allocsAfter.bytes - allocsBefore.bytes) / iterations;
+    const double nsPerIter = elapsed * 1e9 / iterations;
+
+    printf("{\"phase\":\"%s\",\"%s\":%lld,\"iterations\":%lld,\"ns_per_iter\":%.1f,"
+           "\"items_per_sec\":%.1f,\"allocs_per_iter\":%.2f,\"bytes_per_iter\":%.1f}\n",
+           phase, sizeKey, size, iterations, nsPerIter,
+           itemsPerIter * iterations / elapsed, allocs, bytes);
+    fflush(stdout);
+}
+
+static void benchAgents(BenchWorld& world, SharedBuffer* shm) {
+    for (long long n = options.agentsMin; n <= options.agentsMax; n *= 10) {
+        if (n > static_cast<long long>(MAX_CHUNK_SIZE) * MAX_CHUNKS_PER_FRAME) {
+            fprintf(stderr, "Skipping %lld agents: exceeds shared buffer capacity\n", n);
+            break;
+        }
+        world.agentTarget = n;
+        world.reset();
+
+        measure("step", "agents", n, static_cast<double>(n), [&]() {
+            world.executeRules();
+        });
+
+        measure("snapshot", "agents", n, static_cast<double>(n), [&]() {
+            auto snapshot = world.collectAllAgentData();
+            if (snapshot.size() != static_cast<size_t>(n))
+                fprintf(stderr, "⚠️ snapshot size mismatch\n");
+        });
+
+        const std::vector<AgentData> snapshot = world.collectAllAgentData();
+        int frame = 0;
+        measure("publish", "agents", n, static_cast<double>(n), [&]() {
+            writeAgentsPaged(shm, snapshot, frame++);
+        });
+
+        const float boundsMin[3] = {0.0f, 0.0f, 0.0f};
+        const float boundsMax[3] = {world.extent, world.extent, world.extent};
+        AgentStreamSettings quantized;
+        quantized.format = AGENT_FORMAT_QUANTIZED16;
+        measure("publish_quantized", "agents", n, static_cast<double>(n), [&]() {
+            writeAgentStream(shm, snapshot, quantized, boundsMin, boundsMax, frame++);
+        });
+
+        AgentStreamSettings lod = quantized;
+        lod.budget = static_cast<int>(std::max(1LL, n / 10));
+        measure("publish_lod", "agents", n, static_cast<double>(n), [&]() {
+            writeAgentStream(shm, snapshot, lod, boundsMin, boundsMax, frame++);
+        });
+
+        Grid3D<float> field(64, world.extent / 64);
+        field.clear(1.0f);
+        measure("gather", "agents", n, static_cast<double>(n), [&]() {
+            gatherField<BenchAgent>(field, [](BenchAgent& a, float v) { a.uptake = v; });
+        });
+        measure("scatter", "agents", n, static_cast<double>(n), [&]() {
+            scatterToField<BenchAgent>(field, [](const BenchAgent& a) { return a.uptake * 1e-6f; });
+        });
+    }
+    world.agentTarget = 0;  // release the agents before the grid phases
+    world.reset();
+}
+
+static void benchGrids() {
+    for (int n = options.gridMin; n <= options.gridMax; n *= 2) {
+        Grid3D<float> grid(n);
+        for (int z = 0; z < n; ++z)
+            for (int y = 0; y < n; ++y)
+                for (int x = 0; x < n; ++x)
+                    grid.at(x, y, z) = static_cast<float>((x ^ y ^ z) & 7);
+
+        const double cells = static_cast<double>(grid.getTotalSize());
+
+        volatile float sink = 0.0f;
+        measure("grid_neighbors", "grid", n, cells, [&]() {
+            float total = 0.0f;
+            for (int z = 0; z < n; ++z)
+                for (int y = 0; y < n; ++y)
+                    for (int x = 0; x < n; ++x)
+                        grid.forEachNeighbor(x, y, z, [&](int, int, int, const float& v) {
+                            total += v;
+                        });
+            sink = total;
+        });
+        (void)sink;
+
+        volatile double summarySink = 0.0;
+        measure("grid_summarize", "grid", n, cells, [&]() {
+            summarySink = summarize(grid).variance();
+        });
+        measure("grid_histogram", "grid", n, cells, [&]() {
+            summarySink = static_cast<double>(histogram(grid, 64, 0.0, 8.0).counts[0]);
+        });
+        (void)summarySink;
+
+        const size_t bytes = grid.getRequiredSharedMemorySize();
+        void* segment = fakeSegment(bytes);
+        if (!segment) continue;
+        measure("grid_publish", "grid", n, cells, [&]() {
+            grid.writeToMemoryRegion(segment);
+        });
+
+        GridRegion slice;  // middle z-plane, as requested by a slice view
+        slice.offset[2] = n / 2;
+        slice.size[0] = n;
+        slice.size[1] = n;
+        slice.size[2] = 1;
+        measure("grid_publish_slice", "grid", n, static_cast<double>(slice.cellCount()), [&]() {
+            grid.writeRegionToMemoryRegion(segment, slice);
+        });
+        munmap(segment, bytes);
+    }
+}
+
+// Same neighbourhood sweep on a compile-time-extent grid, for the sizes in range.
+template<int N>
+static void benchStaticGrid() {
+    if (N < options.gridMin || N > options.gridMax) return;
+
+    Grid3D<float, N, N, N> grid;
+    for (int z = 0; z < N; ++z)
+        for (int y = 0; y < N; ++y)
+            for (int x = 0; x < N; ++x)
+                grid.at(x, y, z) = static_cast<float>((x ^ y ^ z) & 7);
+
+    volatile float sink = 0.0f;
+    measure("grid_neighbors_static", "grid", N, static_cast<double>(grid.getTotalSize()), [&]() {
+        float total = 0.0f;
+        for (int z = 0; z < N; ++z)
+            for (int y = 0; y < N; ++y)
+                for (int x = 0; x < N; ++x)
+                    grid.forEachNeighbor(x, y, z, [&](int, int, int, const float& v) {
+                        total += v;
+                    });
+        sink = total;
+    });
+    (void)sink;
+}
+
+static bool parseArgs(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--agents-min") options.agentsMin = std::atoll(value);
+        else if (arg == "--agents-max") options.agentsMax = std::atoll(value);
+        else if (arg == "--grid-min") options.gridMin = std::atoi(value);
+        else if (arg == "--grid-max") options.gridMax = std::atoi(value);
+        else if (arg == "--min-time") options.minTime = std::atof(value);
+        else {
+            fprintf(stderr, "Unknown option: %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return options.agentsMin > 0 && options.gridMin > 0;
+}
+
+int main(int argc, char** argv) {
+    if (!parseArgs(argc, argv)) {
+        fprintf(stderr, "Usage: %s [--agents-min N] [--agents-max N] [--grid-min N] "
+                        "[--grid-max N] [--min-time SECONDS]\n", argv[0]);
+        return 1;
+    }
+
+    auto* shm = static_cast<SharedBuffer*>(fakeSegment(sizeof(SharedBuffer)));
+    if (!shm) return 1;
+
+    BenchWorld world;
+    benchAgents(world, shm);
+    benchGrids();
+    benchStaticGrid<64>();
+    benchStaticGrid<128>();
+    benchStaticGrid<256>();
+
+    munmap(shm, sizeof(SharedBuffer));
+    return 0;
+}
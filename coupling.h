@@ -0,0 +1,177 @@
+#ifndef COUPLING_H
+#define COUPLING_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "grid3d.h"
+#include "parallel.h"
+#include "species.h"
+
+// Bulk agent <-> grid coupling. Grid cell (i,j,k) covers
+// origin + [i*cellSize, (i+1)*cellSize) and its value sits at the cell
+// center, the same convention as Grid3D::toWorldCoordinates/fromWorldPosition.
+
+enum SampleMode {
+    SAMPLE_NEAREST = 0,     // value of the cell containing the agent
+    SAMPLE_TRILINEAR = 1    // interpolated between the 8 surrounding cell centers
+};
+
+enum DepositMode {
+    DEPOSIT_NEAREST = 0,        // whole amount into the cell containing the agent
+    DEPOSIT_CLOUD_IN_CELL = 1   // amount spread over the 8 surrounding cells, trilinear weights
+};
+
+namespace coupling_detail {
+
+inline int clampIndex(int i, int size) {
+    return i < 0 ? 0 : (i >= size ? size - 1 : i);
+}
+
+// Lower corner and fractional offset of the 2x2x2 stencil around a position.
+struct Stencil {
+    int i0, j0, k0, i1, j1, k1;
+    float fx, fy, fz;
+};
+
+inline Stencil stencilAt(const Grid3D<float>& grid, const Vec3& p) {
+    const float inv = 1.0f / grid.getCellSize();
+    const Vec3& o = grid.getOrigin();
+    const float gx = (p.x - o.x) * inv - 0.5f;
+    const float gy = (p.y - o.y) * inv - 0.5f;
+    const float gz = (p.z - o.z) * inv - 0.5f;
+    const int i = static_cast<int>(std::floor(gx));
+    const int j = static_cast<int>(std::floor(gy));
+    const int k = static_cast<int>(std::floor(gz));
+
+    Stencil s;
+    s.fx = gx - i;
+    s.fy = gy - j;
+    s.fz = gz - k;
+    s.i0 = clampIndex(i, grid.getXSize());
+    s.j0 = clampIndex(j, grid.getYSize());
+    s.k0 = clampIndex(k, grid.getZSize());
+    s.i1 = clampIndex(i + 1, grid.getXSize());
+    s.j1 = clampIndex(j + 1, grid.getYSize());
+    s.k1 = clampIndex(k + 1, grid.getZSize());
+    return s;
+}
+
+inline bool nearestCell(const Grid3D<float>& grid, const Vec3& p, int& i, int& j, int& k) {
+    const float inv = 1.0f / grid.getCellSize();
+    const Vec3& o = grid.getOrigin();
+    i = static_cast<int>(std::floor((p.x - o.x) * inv));
+    j = static_cast<int>(std::floor((p.y - o.y) * inv));
+    k = static_cast<int>(std::floor((p.z - o.z) * inv));
+    return grid.inBounds(i, j, k);
+}
+
+} // namespace coupling_detail
+
+// Field value at a world position. Positions outside the grid read the
+// nearest boundary cell.
+inline float sampleField(const Grid3D<float>& grid, const Vec3& p, SampleMode mode = SAMPLE_TRILINEAR) {
+    using namespace coupling_detail;
+    if (mode == SAMPLE_NEAREST) {
+        int i, j, k;
+        nearestCell(grid, p, i, j, k);
+        return grid.at(clampIndex(i, grid.getXSize()),
+                       clampIndex(j, grid.getYSize()),
+                       clampIndex(k, grid.getZSize()));
+    }
+
+    const Stencil s = stencilAt(grid, p);
+    const float c00 = grid.at(s.i0, s.j0, s.k0) * (1 - s.fx) + grid.at(s.i1, s.j0, s.k0) * s.fx;
+    const float c10 = grid.at(s.i0, s.j1, s.k0) * (1 - s.fx) + grid.at(s.i1, s.j1, s.k0) * s.fx;
+    const float c01 = grid.at(s.i0, s.j0, s.k1) * (1 - s.fx) + grid.at(s.i1, s.j0, s.k1) * s.fx;
+    const float c11 = grid.at(s.i0, s.j1, s.k1) * (1 - s.fx) + grid.at(s.i1, s.j1, s.k1) * s.fx;
+    const float c0 = c00 * (1 - s.fy) + c10 * s.fy;
+    const float c1 = c01 * (1 - s.fy) + c11 * s.fy;
+    return c0 * (1 - s.fz) + c1 * s.fz;
+}
+
+// Samples `field` at every agent of Derived and hands the value to
+// set(Derived&, float), in parallel over agents. `set` must only touch the
+// agent it is given.
+//   gatherField<Cell>(oxygen, [](Cell& c, float v) { c.oxygen = v; });
+template<typename Derived, typename Setter>
+void gatherField(const Grid3D<float>& field, Setter&& set, SampleMode mode = SAMPLE_TRILINEAR) {
+    const std::vector<Derived*>& agents = Species<Derived>::agents;
+    parallelFor(0, agents.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            Derived* agent = agents[i];
+            if (agent->position)
+                set(*agent, sampleField(field, *agent->position, mode));
+        }
+    });
+}
+
+// Adds amount(const Derived&) of every agent of Derived to `field`.
+// Agents outside the grid deposit nothing; cloud-in-cell weights that fall
+// outside are folded back onto the boundary cells, so the deposited total
+// is conserved.
+//
+// Runs in parallel without atomics: agents are binned into z-slabs two cells
+// thick and the even and odd slabs are processed in two passes. A deposit
+// from slab s reaches at most one layer into its neighbours, so slabs of the
+// same parity never write the same cell. Within a slab agents are deposited
+// in registry order, which keeps the result independent of the thread count.
+template<typename Derived, typename Getter>
+void scatterToField(Grid3D<float>& field, Getter&& amount, DepositMode mode = DEPOSIT_CLOUD_IN_CELL) {
+    using namespace coupling_detail;
+    const std::vector<Derived*>& agents = Species<Derived>::agents;
+    const size_t n = agents.size();
+    if (n == 0) return;
+
+    constexpr int SLAB_THICKNESS = 2;
+    const int slabCount = (field.getZSize() + SLAB_THICKNESS - 1) / SLAB_THICKNESS;
+
+    // Bin agent indices by slab; agents outside the grid go to the extra last bin.
+    std::vector<int> slabOf(n);
+    parallelFor(0, n, [&](size_t begin, size_t end) {
+        for (size_t a = begin; a < end; ++a) {
+            int i, j, k;
+            const Vec3* p = agents[a]->position;
+            slabOf[a] = (p && nearestCell(field, *p, i, j, k)) ? k / SLAB_THICKNESS : slabCount;
+        }
+    });
+    std::vector<size_t> order, slabStart;
+    parallelCountingSort(slabOf, slabCount, order, slabStart);
+
+    auto depositSlab = [&](int slab) {
+        for (size_t o = slabStart[slab]; o < slabStart[slab + 1]; ++o) {
+            const Derived& agent = *agents[order[o]];
+            const float q = amount(agent);
+            const Vec3& p = *agent.position;
+
+            if (mode == DEPOSIT_NEAREST) {
+                int i, j, k;
+                nearestCell(field, p, i, j, k);
+                field.at(i, j, k) += q;
+                continue;
+            }
+
+            const Stencil s = stencilAt(field, p);
+            const float wx[2] = {1 - s.fx, s.fx};
+            const float wy[2] = {1 - s.fy, s.fy};
+            const float wz[2] = {1 - s.fz, s.fz};
+            const int ix[2] = {s.i0, s.i1};
+            const int iy[2] = {s.j0, s.j1};
+            const int iz[2] = {s.k0, s.k1};
+            for (int c = 0; c < 8; ++c) {
+                const int dx = c & 1, dy = (c >> 1) & 1, dz = c >> 2;
+                field.at(ix[dx], iy[dy], iz[dz]) += q * wx[dx] * wy[dy] * wz[dz];
+            }
+        }
+    };
+
+    for (int color = 0; color < 2; ++color) {
+        const size_t slabsOfColor = static_cast<size_t>((slabCount - color + 1) / 2);
+        parallelFor(0, slabsOfColor, [&](size_t begin, size_t end) {
+            for (size_t s = begin; s < end; ++s)
+                depositSlab(color + 2 * static_cast<int>(s));
+        }, 1);
+    }
+}
+
+#endif // COUPLING_H
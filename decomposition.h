@@ -0,0 +1,298 @@
+#ifndef DECOMPOSITION_H
+#define DECOMPOSITION_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "grid3d.h"
+#include "species.h"
+#include "transport.h"
+
+// Splitting one simulation domain over several simulator processes.
+//
+// Every rank owns a box of the global grid and the agents whose positions
+// fall inside it. Its local Grid3D carries `halo` ghost layers on every side,
+// refreshed from the neighbouring ranks by exchangeHalos(); agents that leave
+// the box are handed over by migrateAgents(). Both are collective: every rank
+// must make the same calls in the same order (typically from a rule).
+// Each rank publishes its piece through the usual segments, suffixed with
+// its rank (UGLYLAB_RANK, see rankedShmName), for the viewer to stitch.
+
+enum DecompositionType {
+    DECOMPOSE_SLABS = 0,    // ranks stacked along z
+    DECOMPOSE_BLOCKS = 1    // ranks on a 3D grid chosen to minimise the cut surface
+};
+
+struct Subdomain {
+    int rank = 0;
+    int rankCount = 1;
+    int dims[3] = {1, 1, 1};       // ranks along x, y, z
+    int coords[3] = {0, 0, 0};     // position of this rank in the rank grid
+    int globalSize[3] = {0, 0, 0};
+    int offset[3] = {0, 0, 0};     // global index of the first interior cell
+    int size[3] = {0, 0, 0};       // interior cells
+    int halo = 1;
+    float cellSize = 1.0f;
+
+    int rankAt(int cx, int cy, int cz) const {
+        if (cx < 0 || cx >= dims[0] || cy < 0 || cy >= dims[1] || cz < 0 || cz >= dims[2])
+            return -1;
+        return cx + dims[0] * (cy + dims[1] * cz);
+    }
+
+    // Rank next to this one along `axis` in `direction` (+1/-1), -1 at the domain boundary.
+    int neighbor(int axis, int direction) const {
+        int c[3] = {coords[0], coords[1], coords[2]};
+        c[axis] += direction;
+        return rankAt(c[0], c[1], c[2]);
+    }
+
+    // World-space extent of the interior along `axis`.
+    float lowerBound(int axis) const { return offset[axis] * cellSize; }
+    float upperBound(int axis) const { return (offset[axis] + size[axis]) * cellSize; }
+};
+
+// Fills `d` with the box of `rank`. Returns false if the ranks cannot be laid
+// out on the grid, i.e. some rank would get no cells, or if a split axis
+// leaves a subdomain thinner than `halo`, since exchangeHalos() fills each
+// halo from the adjacent rank's interior alone.
+inline bool decomposeDomain(int xSize, int ySize, int zSize, float cellSize,
+                            int rank, int rankCount, Subdomain& d,
+                            DecompositionType type = DECOMPOSE_BLOCKS, int halo = 1) {
+    if (rankCount < 1 || rank < 0 || rank >= rankCount) {
+        fprintf(stderr, "❌ Invalid rank %d of %d for decomposition\n", rank, rankCount);
+        return false;
+    }
+
+    d = Subdomain();
+    d.rank = rank;
+    d.rankCount = rankCount;
+    d.globalSize[0] = xSize;
+    d.globalSize[1] = ySize;
+    d.globalSize[2] = zSize;
+    d.halo = halo;
+    d.cellSize = cellSize;
+
+    double best = -1.0;
+    if (type == DECOMPOSE_SLABS) {
+        if (rankCount <= zSize) {
+            d.dims[2] = rankCount;
+            best = 0.0;
+        }
+    } else {
+        // Factorisation of rankCount with the smallest total cut area.
+        for (int a = 1; a <= rankCount; ++a) {
+            if (rankCount % a) continue;
+            for (int b = 1; b <= rankCount / a; ++b) {
+                if ((rankCount / a) % b) continue;
+                const int c = rankCount / a / b;
+                if (a > xSize || b > ySize || c > zSize) continue;
+                const double cut = (a - 1.0) * ySize * zSize + (b - 1.0) * xSize * zSize +
+                                   (c - 1.0) * xSize * ySize;
+                if (best < 0.0 || cut < best) {
+                    best = cut;
+                    d.dims[0] = a;
+                    d.dims[1] = b;
+                    d.dims[2] = c;
+                }
+            }
+        }
+    }
+
+    if (best < 0.0) {
+        fprintf(stderr, "❌ Cannot split a %dx%dx%d grid over %d ranks without empty subdomains\n",
+                xSize, ySize, zSize, rankCount);
+        return false;
+    }
+
+    d.coords[0] = rank % d.dims[0];
+    d.coords[1] = (rank / d.dims[0]) % d.dims[1];
+    d.coords[2] = rank / (d.dims[0] * d.dims[1]);
+    for (int axis = 0; axis < 3; ++axis) {
+        const long long n = d.globalSize[axis];
+        const int begin = static_cast<int>(n * d.coords[axis] / d.dims[axis]);
+        const int end = static_cast<int>(n * (d.coords[axis] + 1) / d.dims[axis]);
+        d.offset[axis] = begin;
+        d.size[axis] = end - begin;
+        if (d.size[axis] < halo && d.dims[axis] > 1) {
+            fprintf(stderr, "❌ Subdomain of rank %d is %d cells thick along axis %d, thinner than its halo of %d\n",
+                    rank, d.size[axis], axis, halo);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Local grid of a rank: interior plus halo layers, placed in world space so
+// that fromWorldPosition() and the coupling operators take global positions.
+template<typename T>
+Grid3D<T>* createLocalGrid(const Subdomain& d) {
+    auto* grid = new Grid3D<T>(d.size[0] + 2 * d.halo, d.size[1] + 2 * d.halo,
+                               d.size[2] + 2 * d.halo, d.cellSize);
+    grid->setOrigin(Vec3((d.offset[0] - d.halo) * d.cellSize,
+                         (d.offset[1] - d.halo) * d.cellSize,
+                         (d.offset[2] - d.halo) * d.cellSize));
+    return grid;
+}
+
+namespace decomposition_detail {
+
+// Copies the box [lo, hi) of `grid` to or from a flat buffer, row by row.
+template<typename T>
+void copyBox(Grid3D<T>& grid, const int lo[3], const int hi[3], char* buffer, bool toBuffer) {
+    const size_t rowBytes = static_cast<size_t>(hi[0] - lo[0]) * sizeof(T);
+    for (int z = lo[2]; z < hi[2]; ++z)
+        for (int y = lo[1]; y < hi[1]; ++y) {
+            T* row = &grid.at(lo[0], y, z);
+            if (toBuffer)
+                std::memcpy(buffer, row, rowBytes);
+            else
+                std::memcpy(row, buffer, rowBytes);
+            buffer += rowBytes;
+        }
+}
+
+} // namespace decomposition_detail
+
+// Fills the halo layers of a local grid (see createLocalGrid) with the
+// neighbours' interior values. Axes are exchanged one after another and each
+// exchange includes the halos of the previous axes, so edge and corner
+// ghosts are filled too. Halos on the global boundary are left untouched.
+template<typename T>
+bool exchangeHalos(Grid3D<T>& grid, const Subdomain& d, Transport& transport) {
+    const int h = d.halo;
+    const int full[3] = {grid.getXSize(), grid.getYSize(), grid.getZSize()};
+    std::vector<char> outgoing, incoming;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        if (d.dims[axis] == 1) continue;
+        for (int direction : {+1, -1}) {
+            const int sendTo = d.neighbor(axis, direction);
+            const int receiveFrom = d.neighbor(axis, -direction);
+
+            int sendLo[3] = {0, 0, 0}, sendHi[3] = {full[0], full[1], full[2]};
+            int recvLo[3] = {0, 0, 0}, recvHi[3] = {full[0], full[1], full[2]};
+            if (direction > 0) {
+                sendLo[axis] = d.size[axis];           // last h interior layers
+                sendHi[axis] = d.size[axis] + h;
+                recvLo[axis] = 0;                      // lower halo
+                recvHi[axis] = h;
+            } else {
+                sendLo[axis] = h;                      // first h interior layers
+                sendHi[axis] = 2 * h;
+                recvLo[axis] = d.size[axis] + h;       // upper halo
+                recvHi[axis] = d.size[axis] + 2 * h;
+            }
+
+            size_t layerCells = sizeof(T);
+            for (int a = 0; a < 3; ++a)
+                if (a != axis) layerCells *= static_cast<size_t>(full[a]);
+            const size_t bytes = layerCells * static_cast<size_t>(h);
+
+            outgoing.resize(sendTo >= 0 ? bytes : 0);
+            if (sendTo >= 0)
+                decomposition_detail::copyBox(grid, sendLo, sendHi, outgoing.data(), true);
+
+            if (!transport.exchange(sendTo, outgoing.data(), outgoing.size(), receiveFrom, incoming))
+                return false;
+
+            if (receiveFrom >= 0) {
+                if (incoming.size() != bytes) {
+                    fprintf(stderr, "❌ Halo size mismatch from rank %d (%zu != %zu bytes)\n",
+                            receiveFrom, incoming.size(), bytes);
+                    return false;
+                }
+                decomposition_detail::copyBox(grid, recvLo, recvHi, incoming.data(), false);
+            }
+        }
+    }
+    return true;
+}
+
+// Helpers for migrateAgents() pack/unpack callbacks of trivially copyable state.
+template<typename V>
+void packValue(std::vector<char>& out, const V& value) {
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(V));
+}
+
+template<typename V>
+V unpackValue(const char*& cursor) {
+    V value;
+    std::memcpy(&value, cursor, sizeof(V));
+    cursor += sizeof(V);
+    return value;
+}
+
+// Hands agents of Derived whose position left this rank's interior to the
+// neighbouring rank on that side, and adopts the agents sent here. Agents
+// leaving the global domain stay where they are. Agents may cross at most one
+// subdomain per call along each axis.
+//
+// pack(const Derived&, std::vector<char>&) appends the agent's own state;
+// unpack(x, y, z, const char*& cursor) creates the agent on the receiving
+// rank (e.g. `new Derived(x, y, z)`) and reads back what pack wrote.
+// Migrated agents are deleted on the sending rank.
+template<typename Derived, typename Pack, typename Unpack>
+bool migrateAgents(const Subdomain& d, Transport& transport, Pack&& pack, Unpack&& unpack) {
+    std::vector<Derived*>& agents = Species<Derived>::agents;
+    std::vector<char> outgoing, incoming;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        if (d.dims[axis] == 1) continue;
+        for (int direction : {+1, -1}) {
+            const int sendTo = d.neighbor(axis, direction);
+            const int receiveFrom = d.neighbor(axis, -direction);
+
+            outgoing.assign(sizeof(uint32_t), 0);
+            uint32_t leaving = 0;
+            if (sendTo >= 0) {
+                size_t kept = 0;
+                for (Derived* agent : agents) {
+                    const Vec3* p = agent->position;
+                    const float v = !p ? 0.0f : (axis == 0 ? p->x : (axis == 1 ? p->y : p->z));
+                    const bool leaves = p && (direction > 0 ? v >= d.upperBound(axis)
+                                                            : v < d.lowerBound(axis));
+                    if (!leaves) {
+                        agents[kept++] = agent;
+                        continue;
+                    }
+                    packValue(outgoing, p->x);
+                    packValue(outgoing, p->y);
+                    packValue(outgoing, p->z);
+                    pack(static_cast<const Derived&>(*agent), outgoing);
+                    ++leaving;
+                    delete agent;
+                }
+                agents.resize(kept);
+            }
+            std::memcpy(outgoing.data(), &leaving, sizeof(uint32_t));
+
+            if (!transport.exchange(sendTo, outgoing.data(), outgoing.size(), receiveFrom, incoming))
+                return false;
+
+            if (receiveFrom >= 0 && incoming.size() >= sizeof(uint32_t)) {
+                const char* cursor = incoming.data();
+                const uint32_t arriving = unpackValue<uint32_t>(cursor);
+                for (uint32_t i = 0; i < arriving; ++i) {
+                    const float x = unpackValue<float>(cursor);
+                    const float y = unpackValue<float>(cursor);
+                    const float z = unpackValue<float>(cursor);
+                    unpack(x, y, z, cursor);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Position-only migration for species without extra state to carry over.
+template<typename Derived>
+bool migrateAgents(const Subdomain& d, Transport& transport) {
+    return migrateAgents<Derived>(
+        d, transport,
+        [](const Derived&, std::vector<char>&) {},
+        [](float x, float y, float z, const char*&) { return new Derived(x, y, z); });
+}
+
+#endif // DECOMPOSITION_H
@@ -0,0 +1,253 @@
+#ifndef FIELDSTORE_H
+#define FIELDSTORE_H
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "grid3d.h"
+#include "parallel.h"
+
+// Several named scalar fields (int or float) sharing one set of grid
+// dimensions. Storage is chosen per store:
+//  - FIELD_LAYOUT_SOA: every field is its own Grid3D<T>, best when rules
+//    sweep one field at a time or hand a field to the coupling operators.
+//  - FIELD_LAYOUT_INTERLEAVED: the values of all fields of a cell are
+//    adjacent, best for stencils that read every field of each neighbour.
+// FieldView gives the same indexing over both layouts, and forEachCell()
+// runs one parallel pass in which a stencil may update several fields:
+//
+//   auto u = store.view<float>("u"), v = store.view<float>("v");
+//   auto uNext = store.view<float>("u_next"), vNext = store.view<float>("v_next");
+//   store.forEachCell([&](int x, int y, int z, size_t c) { ... uNext[c] = ...; vNext[c] = ...; });
+//   store.swapFields("u", "u_next"); store.swapFields("v", "v_next");
+
+enum FieldLayout {
+    FIELD_LAYOUT_SOA = 0,
+    FIELD_LAYOUT_INTERLEAVED = 1
+};
+
+template<typename T>
+struct FieldView {
+    T* base = nullptr;
+    size_t stride = 1;  // elements between consecutive cells
+    int xSize = 0, ySize = 0, zSize = 0;
+
+    bool valid() const { return base != nullptr; }
+
+    size_t index(int x, int y, int z) const {
+        return static_cast<size_t>(x) + static_cast<size_t>(xSize) *
+               (static_cast<size_t>(y) + static_cast<size_t>(ySize) * z);
+    }
+    bool inBounds(int x, int y, int z) const {
+        return x >= 0 && x < xSize && y >= 0 && y < ySize && z >= 0 && z < zSize;
+    }
+
+    T& operator[](size_t cell) const { return base[cell * stride]; }
+    T& at(int x, int y, int z) const { return base[index(x, y, z) * stride]; }
+};
+
+class FieldStore {
+public:
+    FieldStore(int xSize, int ySize, int zSize, float cellSize = 1.0f,
+               FieldLayout layout = FIELD_LAYOUT_SOA)
+        : xSize(xSize), ySize(ySize), zSize(zSize), cellSize(cellSize), layout(layout) {}
+
+    int getXSize() const { return xSize; }
+    int getYSize() const { return ySize; }
+    int getZSize() const { return zSize; }
+    float getCellSize() const { return cellSize; }
+    FieldLayout getLayout() const { return layout; }
+    size_t getTotalSize() const {
+        return static_cast<size_t>(xSize) * static_cast<size_t>(ySize) * static_cast<size_t>(zSize);
+    }
+
+    // Adds a field filled with `initial` and returns its id (-1 if the name is
+    // taken). In the interleaved layout a new field re-packs every cell record
+    // and would leave earlier views dangling, so it is refused (-1) once
+    // view() has been called: declare all fields first.
+    template<typename T>
+    int addField(const std::string& name, const T& initial = T()) {
+        static_assert(std::is_same_v<T, float> || std::is_same_v<T, int>,
+                      "Fields hold float or int values");
+        if (findField(name) >= 0) {
+            fprintf(stderr, "⚠️ Field '%s' already exists\n", name.c_str());
+            return -1;
+        }
+        if (layout == FIELD_LAYOUT_INTERLEAVED && viewsHandedOut) {
+            fprintf(stderr, "❌ Cannot add field '%s': interleaved views are already in use\n", name.c_str());
+            return -1;
+        }
+
+        Field field;
+        field.name = name;
+        field.type = std::is_same_v<T, float> ? GRID_TYPE_FLOAT : GRID_TYPE_INT;
+        if (layout == FIELD_LAYOUT_SOA) {
+            auto grid = std::make_unique<Grid3D<T>>(xSize, ySize, zSize, cellSize);
+            grid->clear(initial);
+            field.grid = std::move(grid);
+        } else {
+            field.slot = static_cast<int>(fields.size());
+            growInterleaved();
+        }
+        fields.push_back(std::move(field));
+
+        if (layout == FIELD_LAYOUT_INTERLEAVED) {
+            FieldView<T> v = makeView<T>(static_cast<int>(fields.size()) - 1);
+            parallelFor(0, getTotalSize(), [&](size_t begin, size_t end) {
+                for (size_t c = begin; c < end; ++c) v[c] = initial;
+            });
+        }
+        return static_cast<int>(fields.size()) - 1;
+    }
+
+    int fieldCount() const { return static_cast<int>(fields.size()); }
+    const std::string& fieldName(int id) const { return fields[id].name; }
+    GridDataType fieldType(int id) const { return fields[id].type; }
+
+    int findField(const std::string& name) const {
+        for (size_t i = 0; i < fields.size(); ++i)
+            if (fields[i].name == name) return static_cast<int>(i);
+        return -1;
+    }
+
+    // Strided view of a field; invalid (base == nullptr) on a type mismatch.
+    // Views stay valid for the lifetime of the store: SoA grids never move,
+    // and the interleaved storage is frozen by the first call (see addField).
+    // After swapFields() a view keeps pointing at the same storage, now
+    // under the other name.
+    template<typename T>
+    FieldView<T> view(int id) {
+        FieldView<T> v = makeView<T>(id);
+        if (v.valid() && layout == FIELD_LAYOUT_INTERLEAVED)
+            viewsHandedOut = true;
+        return v;
+    }
+
+    template<typename T>
+    FieldView<T> view(const std::string& name) { return view<T>(findField(name)); }
+
+    // The Grid3D backing a field in the SoA layout (nullptr when interleaved).
+    template<typename T>
+    Grid3D<T>* grid(int id) {
+        if (layout != FIELD_LAYOUT_SOA || id < 0 || id >= fieldCount() || !typeMatches<T>(id))
+            return nullptr;
+        return static_cast<Grid3D<T>*>(fields[id].grid.get());
+    }
+
+    // Exchanges the storage of two fields of the same type; names stay put.
+    // Used to flip the read and write buffers of a double-buffered stencil.
+    bool swapFields(int a, int b) {
+        if (a < 0 || b < 0 || a >= fieldCount() || b >= fieldCount() || fields[a].type != fields[b].type)
+            return false;
+        std::swap(fields[a].grid, fields[b].grid);
+        std::swap(fields[a].slot, fields[b].slot);
+        return true;
+    }
+    bool swapFields(const std::string& a, const std::string& b) {
+        return swapFields(findField(a), findField(b));
+    }
+
+    // Calls func(x, y, z, cell) for every cell, in parallel over z-planes.
+    // Writes must stay within the visited cell.
+    template<typename Func>
+    void forEachCell(Func&& func) const {
+        parallelFor(0, static_cast<size_t>(zSize), [&](size_t zBegin, size_t zEnd) {
+            for (int z = static_cast<int>(zBegin); z < static_cast<int>(zEnd); ++z)
+                for (int y = 0; y < ySize; ++y) {
+                    size_t cell = static_cast<size_t>(xSize) * (y + static_cast<size_t>(ySize) * z);
+                    for (int x = 0; x < xSize; ++x, ++cell)
+                        func(x, y, z, cell);
+                }
+        }, 1);
+    }
+
+    // Shared memory image of one field in the SharedGrid<T> layout.
+    size_t getRequiredSharedMemorySize(int id) const {
+        (void)id;  // int and float fields have the same size
+        return sizeof(SharedGrid<float>) + getTotalSize() * sizeof(float);
+    }
+
+    void writeFieldToMemoryRegion(int id, void* ptr) {
+        if (fields[id].type == GRID_TYPE_FLOAT)
+            writeField<float>(id, ptr);
+        else
+            writeField<int>(id, ptr);
+    }
+
+private:
+    struct Field {
+        std::string name;
+        GridDataType type = GRID_TYPE_FLOAT;
+        std::unique_ptr<Grid> grid;  // SoA storage
+        int slot = 0;                // position within an interleaved cell record
+    };
+
+    int xSize, ySize, zSize;
+    float cellSize;
+    FieldLayout layout;
+    std::vector<Field> fields;
+    std::vector<unsigned char> interleaved;  // fieldCount() 4-byte values per cell
+    bool viewsHandedOut = false;             // interleaved storage may no longer move
+
+    template<typename T>
+    bool typeMatches(int id) const {
+        return fields[id].type == (std::is_same_v<T, float> ? GRID_TYPE_FLOAT : GRID_TYPE_INT);
+    }
+
+    template<typename T>
+    FieldView<T> makeView(int id) {
+        FieldView<T> v;
+        if (id < 0 || id >= fieldCount() || !typeMatches<T>(id)) {
+            fprintf(stderr, "⚠️ No field %d of the requested type\n", id);
+            return v;
+        }
+        v.xSize = xSize;
+        v.ySize = ySize;
+        v.zSize = zSize;
+        if (layout == FIELD_LAYOUT_SOA) {
+            v.base = static_cast<T*>(fields[id].grid->rawVoidData());
+            v.stride = 1;
+        } else {
+            v.base = reinterpret_cast<T*>(interleaved.data()) + fields[id].slot;
+            v.stride = fields.size();
+        }
+        return v;
+    }
+
+    // Re-packs the interleaved records with room for one more field.
+    void growInterleaved() {
+        constexpr size_t WORD = sizeof(float);
+        static_assert(sizeof(int) == WORD, "interleaved fields are 4-byte values");
+        const size_t oldStride = fields.size() * WORD;
+        const size_t newStride = oldStride + WORD;
+        std::vector<unsigned char> grown(getTotalSize() * newStride);
+        if (oldStride > 0) {
+            parallelFor(0, getTotalSize(), [&](size_t begin, size_t end) {
+                for (size_t c = begin; c < end; ++c)
+                    std::memcpy(&grown[c * newStride], &interleaved[c * oldStride], oldStride);
+            });
+        }
+        interleaved.swap(grown);
+    }
+
+    template<typename T>
+    void writeField(int id, void* ptr) {
+        auto* out = reinterpret_cast<SharedGrid<T>*>(ptr);
+        setSharedGridHeader(out, xSize, ySize, zSize, cellSize);
+
+        FieldView<T> v = makeView<T>(id);
+        if (v.stride == 1) {
+            std::memcpy(out->data, v.base, getTotalSize() * sizeof(T));
+            return;
+        }
+        parallelFor(0, getTotalSize(), [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c)
+                out->data[c] = v[c];
+        });
+    }
+};
+
+#endif // FIELDSTORE_H
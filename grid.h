@@ -1,11 +1,27 @@
 #ifndef GRID_H
 #define GRID_H
 #include <cstddef>
+#include "vec3.h"
 enum GridDataType {
     GRID_TYPE_INT = 0,
     GRID_TYPE_FLOAT = 1,
     GRID_TYPE_BOOL = 2
 };
+enum GridLayout {
+    GRID_LAYOUT_DENSE = 0,   // SharedGrid<T>
+    GRID_LAYOUT_SPARSE = 1   // SharedSparseGrid<T>
+};
+// Axis-aligned part of a grid published to the viewer: size[a] cells along
+// each axis, taken every `stride` cells starting at `offset`.
+struct GridRegion {
+    int offset[3] = {0, 0, 0};
+    int size[3] = {0, 0, 0};
+    int stride = 1;
+
+    size_t cellCount() const {
+        return static_cast<size_t>(size[0]) * static_cast<size_t>(size[1]) * static_cast<size_t>(size[2]);
+    }
+};
 class Grid {
 public:
     virtual ~Grid() = default;
@@ -14,11 +30,21 @@ public:
     virtual int getYSize() const = 0;
     virtual int getZSize() const = 0;
     virtual float getCellSize() const = 0;
+    // World position of the corner of cell (0,0,0).
+    virtual const Vec3& getOrigin() const = 0;
 
     virtual void writeToMemoryRegion(void* ptr) const = 0;
     virtual size_t getRequiredSharedMemorySize() const = 0;
+    // Publishes only `region` and returns the bytes written. Grids without a
+    // region-aware layout publish everything.
+    virtual size_t writeRegionToMemoryRegion(void* ptr, const GridRegion& region) const {
+        (void)region;
+        writeToMemoryRegion(ptr);
+        return getRequiredSharedMemorySize();
+    }
 
     virtual void* rawVoidData() = 0;  // allow raw access if needed
     virtual GridDataType getType() const = 0;
+    virtual GridLayout getLayout() const { return GRID_LAYOUT_DENSE; }
 };
 #endif // GRID_H
@@ -1,27 +1,94 @@
 #ifndef GRID3D_H
 #define GRID3D_H
+#include <cmath>
+#include <cstddef>
 #include <cstring>
+#include <type_traits>
+#include <utility>
 #include <vector>
 #include <cassert>
 #include "vec3.h"
 #include "grid.h"
+#include "memorypolicy.h"
+#include "parallel.h"
 
 template<typename T>
 struct SharedGrid {
     int xSize, ySize, zSize;
     float cellSize;
+    // Cells held in data: regionSize[0] x regionSize[1] x regionSize[2]
+    // values, x fastest, sampled every regionStride cells from regionOffset.
+    // The whole grid unless the viewer requested a region (CommandBuffer::roi*).
+    int regionOffset[3];
+    int regionSize[3];
+    int regionStride;
     T data[];  // flexible array member
 };
 
+// Fills the header of a SharedGrid holding the whole x*y*z grid.
 template<typename T>
-class Grid3D :public Grid {
+inline void setSharedGridHeader(SharedGrid<T>* out, int x, int y, int z, float cellSize) {
+    out->xSize = x;
+    out->ySize = y;
+    out->zSize = z;
+    out->cellSize = cellSize;
+    out->regionOffset[0] = out->regionOffset[1] = out->regionOffset[2] = 0;
+    out->regionSize[0] = x;
+    out->regionSize[1] = y;
+    out->regionSize[2] = z;
+    out->regionStride = 1;
+}
+
+namespace grid_detail {
+
+constexpr bool isPowerOfTwo(int n) { return n > 0 && (n & (n - 1)) == 0; }
+constexpr int log2Of(int n) { return n <= 1 ? 0 : 1 + log2Of(n / 2); }
+
+// Grid sizes: compile-time constants when all three are non-zero,
+// run-time members otherwise.
+template<int X, int Y, int Z>
+struct GridExtents {
+    static_assert(X > 0 && Y > 0 && Z > 0, "Static grid extents must be positive");
+    static constexpr bool isStatic = true;
+    static constexpr int xSize = X, ySize = Y, zSize = Z;
+};
+
+template<>
+struct GridExtents<0, 0, 0> {
+    static constexpr bool isStatic = false;
+    int xSize, ySize, zSize;
+};
+
+} // namespace grid_detail
+
+// Dense 3D grid. Grid3D<T> takes its sizes at construction; Grid3D<T, X, Y, Z>
+// fixes them at compile time, so indexing becomes shifts and masks for
+// power-of-two extents and neighbourhood offsets are constants:
+//
+//   Grid3D<float, 256, 256, 256> field(1.0f);   // cellSize only
+//
+// Both publish through the same Grid interface.
+template<typename T, int X = 0, int Y = 0, int Z = 0>
+class Grid3D : public Grid, private grid_detail::GridExtents<X, Y, Z> {
+    using Extents = grid_detail::GridExtents<X, Y, Z>;
+    using Extents::xSize;
+    using Extents::ySize;
+    using Extents::zSize;
+
 public:
+    static constexpr bool isStaticExtent = Extents::isStatic;
+
+    template<bool S = isStaticExtent, std::enable_if_t<!S, int> = 0>
     Grid3D(int size, float cellSize = 1.0f)
-        : xSize(size), ySize(size), zSize(size), cellSize(cellSize),
-        data(size * size * size) {}
+        : Extents{size, size, size}, cellSize(cellSize),
+        data(getTotalSize()) { clear(); }
+    template<bool S = isStaticExtent, std::enable_if_t<!S, int> = 0>
     Grid3D(int xSize, int ySize, int zSize, float cellSize = 1.0f)
-        : xSize(xSize), ySize(ySize), zSize(zSize), cellSize(cellSize),
-        data(xSize * ySize * zSize) {}
+        : Extents{xSize, ySize, zSize}, cellSize(cellSize),
+        data(getTotalSize()) { clear(); }
+    template<bool S = isStaticExtent, std::enable_if_t<S, int> = 0>
+    explicit Grid3D(float cellSize = 1.0f)
+        : cellSize(cellSize), data(getTotalSize()) { clear(); }
 
     inline T& at(int x, int y, int z) {
         assert(inBounds(x, y, z));
@@ -34,9 +101,9 @@ public:
     }
 
     inline bool inBounds(int x, int y, int z) const {
-        return x >= 0 && x < xSize &&
-               y >= 0 && y < ySize &&
-               z >= 0 && z < zSize;
+        return static_cast<unsigned>(x) < static_cast<unsigned>(xSize) &&
+               static_cast<unsigned>(y) < static_cast<unsigned>(ySize) &&
+               static_cast<unsigned>(z) < static_cast<unsigned>(zSize);
     }
 
     inline int getXSize() const override { return xSize; }
@@ -44,57 +111,89 @@ public:
     inline int getZSize() const override { return zSize; }
     inline float getCellSize() const override { return cellSize; }
     void* rawVoidData() override { return data.data(); }
+    T* rawData() { return data.data(); }
+    const T* rawData() const { return data.data(); }
 
     void writeToMemoryRegion(void* ptr) const override{
         auto* out = reinterpret_cast<SharedGrid<T>*>(ptr);
-        out->xSize = xSize;
-        out->ySize = ySize;
-        out->zSize = zSize;
-        out->cellSize = cellSize;
+        setSharedGridHeader(out, xSize, ySize, zSize, cellSize);
         std::memcpy(out->data, data.data(), getTotalSize() * sizeof(T));
     }
 
+    // Copies the region row by row, in parallel over rows.
+    size_t writeRegionToMemoryRegion(void* ptr, const GridRegion& region) const override {
+        auto* out = reinterpret_cast<SharedGrid<T>*>(ptr);
+        setSharedGridHeader(out, xSize, ySize, zSize, cellSize);
+        for (int a = 0; a < 3; ++a) {
+            out->regionOffset[a] = region.offset[a];
+            out->regionSize[a] = region.size[a];
+        }
+        out->regionStride = region.stride;
+
+        const int stride = region.stride;
+        const size_t rowCells = static_cast<size_t>(region.size[0]);
+        const size_t rows = static_cast<size_t>(region.size[1]) * static_cast<size_t>(region.size[2]);
+        parallelFor(0, rows, [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; ++r) {
+                const int y = region.offset[1] + static_cast<int>(r % region.size[1]) * stride;
+                const int z = region.offset[2] + static_cast<int>(r / region.size[1]) * stride;
+                const T* src = &data[index(region.offset[0], y, z)];
+                T* dst = out->data + r * rowCells;
+                if (stride == 1) {
+                    std::memcpy(dst, src, rowCells * sizeof(T));
+                } else {
+                    for (size_t i = 0; i < rowCells; ++i)
+                        dst[i] = src[i * stride];
+                }
+            }
+        }, 16);
+        return sizeof(SharedGrid<T>) + region.cellCount() * sizeof(T);
+    }
+
     size_t getRequiredSharedMemorySize() const override{
         return sizeof(SharedGrid<T>) + getTotalSize() * sizeof(T);
     }
 
 
+    // Also performs the first touch of freshly allocated storage, from the
+    // workers that own each block (see memorypolicy.h).
     void clear(const T& value = T()) {
-        std::fill(data.begin(), data.end(), value);
+        parallelFirstTouch(data, value);
     }
 
+    // World position of the corner of cell (0,0,0). Zero unless the grid is
+    // one piece of a decomposed domain.
+    void setOrigin(const Vec3& o) { origin = o; }
+    const Vec3& getOrigin() const override { return origin; }
+
     // Convert from grid indices (i,j,k) to world coordinates
     Vec3 toWorldCoordinates(int i, int j, int k) const {
         return Vec3{
-            (i + 0.5f) * cellSize,
-            (j + 0.5f) * cellSize,
-            (k + 0.5f) * cellSize
+            origin.x + (i + 0.5f) * cellSize,
+            origin.y + (j + 0.5f) * cellSize,
+            origin.z + (k + 0.5f) * cellSize
         };
     }
 
     // Convert from world coordinates (x,y,z) to grid indices (i,j,k)
     Vec3 fromWorldPosition(float x, float y, float z) const {
-        int i = static_cast<int>(std::floor(x / cellSize));
-        int j = static_cast<int>(std::floor(y / cellSize));
-        int k = static_cast<int>(std::floor(z / cellSize));
+        int i = static_cast<int>(std::floor((x - origin.x) / cellSize));
+        int j = static_cast<int>(std::floor((y - origin.y) / cellSize));
+        int k = static_cast<int>(std::floor((z - origin.z) / cellSize));
         return Vec3(i, j, k);
     }
 
+    // Calls func(nx, ny, nz, value) for the in-bounds cells of the 3x3x3
+    // neighbourhood, z-major then y then x. The 27 offsets are unrolled at
+    // compile time and interior cells skip the bounds checks.
     template<typename Func>
     void forEachNeighbor(int x, int y, int z, Func&& func, bool includeCenter = false) const {
-        for (int dz = -1; dz <= 1; ++dz)
-            for (int dy = -1; dy <= 1; ++dy)
-                for (int dx = -1; dx <= 1; ++dx) {
-                    if (!includeCenter && dx == 0 && dy == 0 && dz == 0)
-                        continue;
-
-                    int nx = x + dx;
-                    int ny = y + dy;
-                    int nz = z + dz;
-
-                    if (inBounds(nx, ny, nz))
-                        func(nx, ny, nz, at(nx, ny, nz));
-                }
+        const bool interior = x > 0 && y > 0 && z > 0 &&
+                              x < xSize - 1 && y < ySize - 1 && z < zSize - 1;
+        if (interior)
+            visitInterior(x, y, z, func, includeCenter, std::make_integer_sequence<int, 27>());
+        else
+            visitBorder(x, y, z, func, includeCenter, std::make_integer_sequence<int, 27>());
     }
 
     std::size_t getTotalSize() const {
@@ -111,12 +210,60 @@ public:
     }
 
 private:
-    int xSize, ySize, zSize;
     float cellSize;
-    std::vector<T> data;
+    Vec3 origin;
+    std::vector<T, BulkAllocator<T>> data;
 
-    inline int index(int x, int y, int z) const {
-        return x + xSize * (y + ySize * z);
+    inline std::size_t index(int x, int y, int z) const {
+        if constexpr (isStaticExtent && grid_detail::isPowerOfTwo(X) && grid_detail::isPowerOfTwo(Y)) {
+            constexpr int xShift = grid_detail::log2Of(X);
+            constexpr int yShift = grid_detail::log2Of(Y);
+            return static_cast<std::size_t>(x) |
+                   (static_cast<std::size_t>(y) << xShift) |
+                   (static_cast<std::size_t>(z) << (xShift + yShift));
+        } else {
+            return static_cast<std::size_t>(x) + static_cast<std::size_t>(xSize) *
+                   (static_cast<std::size_t>(y) + static_cast<std::size_t>(ySize) * z);
+        }
+    }
+
+    // Offset of neighbour K (0..26, x fastest) from its centre cell.
+    static constexpr int neighborDx(int k) { return k % 3 - 1; }
+    static constexpr int neighborDy(int k) { return (k / 3) % 3 - 1; }
+    static constexpr int neighborDz(int k) { return k / 9 - 1; }
+
+    template<typename Func, int... K>
+    inline void visitInterior(int x, int y, int z, Func& func, bool includeCenter,
+                              std::integer_sequence<int, K...>) const {
+        const T* center = &data[index(x, y, z)];
+        const std::ptrdiff_t row = xSize;
+        const std::ptrdiff_t plane = static_cast<std::ptrdiff_t>(xSize) * ySize;
+        auto visit = [&](auto k) {
+            constexpr int dx = neighborDx(decltype(k)::value);
+            constexpr int dy = neighborDy(decltype(k)::value);
+            constexpr int dz = neighborDz(decltype(k)::value);
+            if constexpr (dx == 0 && dy == 0 && dz == 0) {
+                if (!includeCenter) return;
+            }
+            func(x + dx, y + dy, z + dz, center[dx + dy * row + dz * plane]);
+        };
+        (visit(std::integral_constant<int, K>()), ...);
+    }
+
+    template<typename Func, int... K>
+    inline void visitBorder(int x, int y, int z, Func& func, bool includeCenter,
+                            std::integer_sequence<int, K...>) const {
+        auto visit = [&](auto k) {
+            constexpr int dx = neighborDx(decltype(k)::value);
+            constexpr int dy = neighborDy(decltype(k)::value);
+            constexpr int dz = neighborDz(decltype(k)::value);
+            if constexpr (dx == 0 && dy == 0 && dz == 0) {
+                if (!includeCenter) return;
+            }
+            if (inBounds(x + dx, y + dy, z + dz))
+                func(x + dx, y + dy, z + dz, data[index(x + dx, y + dy, z + dz)]);
+        };
+        (visit(std::integral_constant<int, K>()), ...);
     }
 };
 #endif // GRID3D_H
@@ -0,0 +1,109 @@
+#ifndef MEMORYPOLICY_H
+#define MEMORYPOLICY_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include "parallel.h"
+
+// Placement of the large buffers (grid storage, shared memory segments).
+//
+// Huge pages: regions of 2 MB and more are advised for transparent huge
+// pages (madvise MADV_HUGEPAGE), which cuts TLB misses on grid sweeps and
+// agent publishing. Shared memory segments only get them when the kernel
+// allows THP for shmem (/sys/kernel/mm/transparent_hugepage/shmem_enabled
+// set to "advise" or "always"); otherwise the advice is a no-op. Set
+// UGLYLAB_HUGEPAGES=0 to turn the advice off.
+//
+// NUMA: a page lands on the node of the thread that first writes it. Grid
+// storage is therefore not initialised by the allocating thread but by the
+// worker pool, with the same contiguous per-worker blocks the parallel
+// kernels use (parallelFirstTouch), so each worker's cells are local to it.
+// Combine with UGLYLAB_PIN_THREADS=1 (see WorkerPool) so the spawned workers
+// stay on the node where their pages were placed; worker 0's block follows
+// the calling thread, which keeps its own affinity.
+
+constexpr size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+
+inline bool hugePagesEnabled() {
+    static const bool enabled = [] {
+        const char* env = std::getenv("UGLYLAB_HUGEPAGES");
+        return !env || std::atoi(env) != 0;
+    }();
+    return enabled;
+}
+
+// Advises the 2 MB-aligned part of [ptr, ptr + bytes) for huge pages. Errors
+// (THP unavailable) are ignored: the memory simply stays on small pages.
+inline void adviseHugePages(void* ptr, size_t bytes) {
+#ifdef MADV_HUGEPAGE
+    if (!hugePagesEnabled() || !ptr || bytes < HUGE_PAGE_SIZE) return;
+    const uintptr_t begin = (reinterpret_cast<uintptr_t>(ptr) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    const uintptr_t end = (reinterpret_cast<uintptr_t>(ptr) + bytes) & ~(HUGE_PAGE_SIZE - 1);
+    if (end > begin)
+        madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE);
+#else
+    (void)ptr;
+    (void)bytes;
+#endif
+}
+
+// Allocator for bulk grid storage. Blocks of 2 MB and more are 2 MB-aligned
+// and advised for huge pages. Elements are default-initialised, so building
+// a std::vector of trivial values does not touch its pages: the owner fills
+// them with parallelFirstTouch().
+template<typename T>
+struct BulkAllocator {
+    using value_type = T;
+
+    BulkAllocator() = default;
+    template<typename U>
+    BulkAllocator(const BulkAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        const size_t bytes = n * sizeof(T);
+        if (bytes < HUGE_PAGE_SIZE)
+            return static_cast<T*>(::operator new(bytes));
+
+        const size_t rounded = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        void* ptr = std::aligned_alloc(HUGE_PAGE_SIZE, rounded);
+        if (!ptr) throw std::bad_alloc();
+        adviseHugePages(ptr, rounded);
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, size_t n) {
+        if (n * sizeof(T) < HUGE_PAGE_SIZE)
+            ::operator delete(ptr);
+        else
+            std::free(ptr);
+    }
+
+    template<typename U>
+    void construct(U* ptr) { ::new (static_cast<void*>(ptr)) U; }
+    template<typename U, typename... Args>
+    void construct(U* ptr, Args&&... args) { ::new (static_cast<void*>(ptr)) U(std::forward<Args>(args)...); }
+
+    template<typename U>
+    bool operator==(const BulkAllocator<U>&) const { return true; }
+    template<typename U>
+    bool operator!=(const BulkAllocator<U>&) const { return false; }
+};
+
+// Sets every element of `values` to `value` from the worker pool, one
+// contiguous block per worker as in parallelFor(), so that each page is first
+// touched (and placed) by the worker that later processes it.
+template<typename T, typename Alloc>
+void parallelFirstTouch(std::vector<T, Alloc>& values, const T& value) {
+    T* data = values.data();
+    parallelFor(0, values.size(), [data, &value](size_t begin, size_t end) {
+        std::fill(data + begin, data + end, value);
+    }, 4096);
+}
+
+#endif // MEMORYPOLICY_H
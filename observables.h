@@ -0,0 +1,127 @@
+#ifndef OBSERVABLES_H
+#define OBSERVABLES_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "uglylab_sharedmemory.h"
+
+// Binned counts over [lo, hi); values outside fall into underflow/overflow.
+struct Histogram {
+    double lo = 0.0, hi = 0.0;
+    std::vector<long long> counts;
+    long long underflow = 0, overflow = 0;
+
+    double binWidth() const { return counts.empty() ? 0.0 : (hi - lo) / counts.size(); }
+};
+
+// Per-step quantities recorded by the rules (total mass, concentration
+// range, ...) and published by the simulator in SharedBuffer::observables,
+// so the viewer can plot them without reading the grids. Only what was set
+// since the last beginStep() is read back and published, so a rule that
+// skips a step does not leave a stale value on the plot. Names are truncated
+// to MAX_OBSERVABLE_NAME - 1.
+class Observables {
+public:
+    // Starts a new step: every value and histogram becomes unset. Entries
+    // keep their slot, so storage is reused from one step to the next.
+    void beginStep() {
+        for (auto& entry : values) entry.current = false;
+        for (auto& entry : histograms) entry.current = false;
+    }
+
+    void set(const std::string& name, double value) {
+        for (auto& entry : values)
+            if (entry.name == name) {
+                entry.value = value;
+                entry.current = true;
+                return;
+            }
+        if (values.size() == MAX_OBSERVABLES) {
+            fprintf(stderr, "⚠️ Too many observables, '%s' is not recorded\n", name.c_str());
+            return;
+        }
+        values.push_back({name, value, true});
+    }
+
+    void setHistogram(const std::string& name, const Histogram& histogram) {
+        for (auto& entry : histograms)
+            if (entry.name == name) {
+                entry.value = histogram;
+                entry.current = true;
+                return;
+            }
+        if (histograms.size() == MAX_OBSERVED_HISTOGRAMS) {
+            fprintf(stderr, "⚠️ Too many histograms, '%s' is not recorded\n", name.c_str());
+            return;
+        }
+        histograms.push_back({name, histogram, true});
+    }
+
+    // Value recorded under `name` this step, or `fallback` if there is none.
+    double get(const std::string& name, double fallback = 0.0) const {
+        for (const auto& entry : values)
+            if (entry.current && entry.name == name) return entry.value;
+        return fallback;
+    }
+
+    void clear() {
+        values.clear();
+        histograms.clear();
+    }
+
+    void writeTo(StepObservables* out, int step) const {
+        if (!out) return;
+
+        out->sequence.fetch_add(1, std::memory_order_acq_rel);  // odd: write in progress
+
+        out->step = step;
+        int count = 0;
+        for (const auto& entry : values) {
+            if (!entry.current) continue;
+            copyName(out->names[count], entry.name);
+            out->values[count] = entry.value;
+            ++count;
+        }
+        out->count = count;
+
+        int histogramCount = 0;
+        for (const auto& entry : histograms) {
+            if (!entry.current) continue;
+            const Histogram& h = entry.value;
+            ObservedHistogram& o = out->histograms[histogramCount++];
+            copyName(o.name, entry.name);
+            o.binCount = std::min(static_cast<int>(h.counts.size()), MAX_HISTOGRAM_BINS);
+            o.lo = h.lo;
+            o.hi = h.counts.empty() ? h.hi : h.lo + h.binWidth() * o.binCount;
+            o.underflow = h.underflow;
+            o.overflow = h.overflow;
+            for (size_t b = o.binCount; b < h.counts.size(); ++b)
+                o.overflow += h.counts[b];  // bins beyond the shared capacity
+            std::copy(h.counts.begin(), h.counts.begin() + o.binCount, o.counts);
+        }
+        out->histogramCount = histogramCount;
+
+        out->sequence.fetch_add(1, std::memory_order_release);  // even: consistent
+    }
+
+private:
+    template<typename V>
+    struct Entry {
+        std::string name;
+        V value;
+        bool current;  // set since the last beginStep()
+    };
+
+    std::vector<Entry<double>> values;
+    std::vector<Entry<Histogram>> histograms;
+
+    static void copyName(char* out, const std::string& name) {
+        std::strncpy(out, name.c_str(), MAX_OBSERVABLE_NAME - 1);
+        out[MAX_OBSERVABLE_NAME - 1] = '\0';
+    }
+};
+
+#endif // OBSERVABLES_H
@@ -0,0 +1,124 @@
+#include "parallel.h"
+#include <cstdio>
+#include <cstdlib>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+static thread_local bool insideParallelRegion = false;
+
+static int defaultWorkerCount() {
+    if (const char* env = std::getenv("UGLYLAB_THREADS")) {
+        const int requested = std::atoi(env);
+        if (requested > 0) return requested;
+    }
+    const unsigned int hardware = std::thread::hardware_concurrency();
+    return hardware > 0 ? static_cast<int>(hardware) : 1;
+}
+
+// With UGLYLAB_PIN_THREADS=1, spawned worker w is bound to the w-th CPU the
+// process may run on, so the blocks a worker first-touched stay on its NUMA
+// node. Worker 0 is whichever thread calls run() and is left unpinned: the
+// pool must not narrow the affinity of a thread it does not own.
+#ifdef __linux__
+static bool pinningRequested() {
+    const char* env = std::getenv("UGLYLAB_PIN_THREADS");
+    return env && std::atoi(env) != 0;
+}
+
+static void pinThread(pthread_t thread, int worker) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+    const int cpuCount = CPU_COUNT(&allowed);
+    if (cpuCount == 0) return;
+
+    int target = worker % cpuCount;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        if (target-- > 0) continue;
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        if (pthread_setaffinity_np(thread, sizeof(one), &one) != 0)
+            fprintf(stderr, "⚠️ Could not pin worker %d to CPU %d\n", worker, cpu);
+        return;
+    }
+}
+#endif
+
+WorkerPool& WorkerPool::instance() {
+    static WorkerPool pool(defaultWorkerCount());
+    return pool;
+}
+
+WorkerPool::WorkerPool(int count) : workerCount(count) {
+    for (int worker = 1; worker < workerCount; ++worker) {
+        threads.emplace_back(&WorkerPool::workerLoop, this, worker);
+    }
+
+#ifdef __linux__
+    if (pinningRequested()) {
+        for (int worker = 1; worker < workerCount; ++worker)
+            pinThread(threads[worker - 1].native_handle(), worker);
+    }
+#endif
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::run(const std::function<void(int)>& task) {
+    if (insideParallelRegion || workerCount == 1) {
+        for (int worker = 0; worker < workerCount; ++worker) {
+            task(worker);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> runLock(runMutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &task;
+        pending = workerCount - 1;
+        ++generation;
+    }
+    wake.notify_all();
+
+    insideParallelRegion = true;
+    task(0);
+    insideParallelRegion = false;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+    job = nullptr;
+}
+
+void WorkerPool::workerLoop(int worker) {
+    insideParallelRegion = true;
+    unsigned long long seen = 0;
+    while (true) {
+        const std::function<void(int)>* task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            task = job;
+        }
+
+        (*task)(worker);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0)
+            done.notify_one();
+    }
+}
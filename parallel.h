@@ -0,0 +1,149 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads shared by the bulk operators of the library.
+// Work is always split into one contiguous block per worker, so a given
+// range of cells or agents lands on the same thread from one call to the next.
+class WorkerPool {
+public:
+    static WorkerPool& instance();
+
+    // Number of workers, including the calling thread. Defaults to the
+    // hardware concurrency; override with the UGLYLAB_THREADS environment variable.
+    // UGLYLAB_PIN_THREADS=1 binds each spawned worker (1 and up) to its own CPU.
+    int size() const { return workerCount; }
+
+    // Runs job(worker) once for every worker in [0, size()) and waits for all
+    // of them. Worker 0 is the calling thread. Nested calls run serially.
+    void run(const std::function<void(int)>& job);
+
+private:
+    explicit WorkerPool(int count);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void workerLoop(int worker);
+
+    int workerCount;
+    std::vector<std::thread> threads;
+    std::mutex runMutex;  // one parallel region at a time
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int)>* job = nullptr;
+    unsigned long long generation = 0;
+    int pending = 0;
+    bool stopping = false;
+};
+
+// Block [begin, end) of `worker` when [first, last) is split evenly over `workers`.
+inline void workerRange(size_t first, size_t last, int worker, int workers,
+                        size_t& begin, size_t& end) {
+    const size_t count = last - first;
+    const size_t w = static_cast<size_t>(worker);
+    const size_t n = static_cast<size_t>(workers);
+    begin = first + count * w / n;
+    end = first + count * (w + 1) / n;
+}
+
+// Calls func(blockBegin, blockEnd) on disjoint blocks covering [first, last).
+// Ranges shorter than `grain` run on the calling thread.
+template<typename Func>
+void parallelFor(size_t first, size_t last, Func&& func, size_t grain = 1024) {
+    if (last <= first) return;
+
+    WorkerPool& pool = WorkerPool::instance();
+    if (pool.size() == 1 || last - first < grain) {
+        func(first, last);
+        return;
+    }
+
+    pool.run([&](int worker) {
+        size_t begin, end;
+        workerRange(first, last, worker, pool.size(), begin, end);
+        if (begin < end)
+            func(begin, end);
+    });
+}
+
+// Reduces [first, last): every block folds its elements into its own copy
+// of `identity` with func(blockBegin, blockEnd, R& partial), and the partials
+// are merged with combine(R& into, const R& from) in block order, so the
+// result does not depend on thread timing.
+template<typename R, typename Func, typename Combine>
+R parallelReduce(size_t first, size_t last, const R& identity, Func&& func, Combine&& combine,
+                 size_t grain = 1024) {
+    R result = identity;
+    if (last <= first) return result;
+
+    WorkerPool& pool = WorkerPool::instance();
+    if (pool.size() == 1 || last - first < grain) {
+        func(first, last, result);
+        return result;
+    }
+
+    std::vector<R> partial(pool.size(), identity);
+    pool.run([&](int worker) {
+        size_t begin, end;
+        workerRange(first, last, worker, pool.size(), begin, end);
+        if (begin < end)
+            func(begin, end, partial[worker]);
+    });
+    for (const R& p : partial)
+        combine(result, p);
+    return result;
+}
+
+// Stable parallel counting sort. bucketOf[i] in [0, bucketCount] is the key
+// of element i. On return `order` lists the element indices grouped by key,
+// in ascending index order within a group, and the indices of group b are
+// order[bucketStart[b]] .. order[bucketStart[b + 1] - 1].
+inline void parallelCountingSort(const std::vector<int>& bucketOf, int bucketCount,
+                                 std::vector<size_t>& order, std::vector<size_t>& bucketStart) {
+    const size_t n = bucketOf.size();
+    WorkerPool& pool = WorkerPool::instance();
+    const int workers = pool.size();
+    const size_t buckets = static_cast<size_t>(bucketCount) + 1;
+
+    std::vector<size_t> counts(static_cast<size_t>(workers) * buckets, 0);
+    pool.run([&](int worker) {
+        size_t begin, end;
+        workerRange(0, n, worker, workers, begin, end);
+        size_t* local = &counts[static_cast<size_t>(worker) * buckets];
+        for (size_t i = begin; i < end; ++i)
+            ++local[bucketOf[i]];
+    });
+
+    // Offsets ordered by (bucket, worker) keep each group in index order.
+    bucketStart.assign(buckets + 1, 0);
+    size_t offset = 0;
+    for (size_t b = 0; b < buckets; ++b) {
+        bucketStart[b] = offset;
+        for (int worker = 0; worker < workers; ++worker) {
+            size_t& c = counts[static_cast<size_t>(worker) * buckets + b];
+            const size_t count = c;
+            c = offset;
+            offset += count;
+        }
+    }
+    bucketStart[buckets] = offset;
+
+    order.resize(n);
+    pool.run([&](int worker) {
+        size_t begin, end;
+        workerRange(0, n, worker, workers, begin, end);
+        size_t* cursor = &counts[static_cast<size_t>(worker) * buckets];
+        for (size_t i = begin; i < end; ++i)
+            order[cursor[bucketOf[i]]++] = i;
+    });
+}
+
+#endif // PARALLEL_H
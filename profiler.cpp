@@ -0,0 +1,184 @@
+#include "profiler.h"
+#include "rule.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <typeinfo>
+#ifdef __GNUG__
+#include <cxxabi.h>
+#endif
+
+// ---------- Allocation tracking ----------
+#ifdef UGLYLAB_TRACK_ALLOCATIONS
+static std::atomic<long long> allocCount{0};
+static std::atomic<long long> allocBytes{0};
+
+#if defined(__GNUC__) && !defined(__clang__)
+// GCC reports the malloc/free pair inside replaced operators as mismatched.
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size) {
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    allocBytes.fetch_add(static_cast<long long>(size), std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+bool allocationTrackingEnabled() { return true; }
+
+AllocationStats allocationStats() {
+    return {allocCount.load(std::memory_order_relaxed), allocBytes.load(std::memory_order_relaxed)};
+}
+#else
+bool allocationTrackingEnabled() { return false; }
+
+AllocationStats allocationStats() { return {0, 0}; }
+#endif
+
+static long long elapsedNs(StepProfiler::Clock::time_point start, StepProfiler::Clock::time_point end) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+static std::string ruleName(const Rule& rule) {
+    const char* name = typeid(rule).name();
+#ifdef __GNUG__
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if (status == 0 && demangled) {
+        std::string result(demangled);
+        std::free(demangled);
+        return result;
+    }
+#endif
+    return name;
+}
+
+StepProfiler::~StepProfiler() {
+    stopTrace();
+}
+
+void StepProfiler::beginStep(long long stepIndex) {
+    step = stepIndex;
+    std::fill(std::begin(phaseNs), std::end(phaseNs), 0);
+    std::fill(ruleNs.begin(), ruleNs.end(), 0);
+    rulesThisStep = 0;
+    agentCount = 0;
+    publishedBytes = 0;
+    allocationsAtStart = allocationStats();
+    stepStart = Clock::now();
+}
+
+void StepProfiler::endStep() {
+    const Clock::time_point end = Clock::now();
+    stepNs = elapsedNs(stepStart, end);
+
+    ruleNs.resize(rulesThisStep);
+    ruleTypes.resize(rulesThisStep);
+    ruleNames.resize(rulesThisStep);
+
+    const AllocationStats current = allocationStats();
+    allocations = {current.count - allocationsAtStart.count,
+                   current.bytes - allocationsAtStart.bytes};
+
+    if (trace)
+        traceEvent("step", "step", stepStart, end);
+}
+
+void StepProfiler::beginPhase(StepPhase phase) {
+    phaseStart[phase] = Clock::now();
+}
+
+void StepProfiler::endPhase(StepPhase phase) {
+    static const char* const phaseNames[PHASE_COUNT] = {
+        "rules", "collect_agents", "publish_agents", "publish_grid"
+    };
+
+    const Clock::time_point end = Clock::now();
+    phaseNs[phase] += elapsedNs(phaseStart[phase], end);
+    if (trace)
+        traceEvent(phaseNames[phase], "phase", phaseStart[phase], end);
+}
+
+void StepProfiler::recordRule(int index, const Rule& rule, Clock::time_point start) {
+    const Clock::time_point end = Clock::now();
+    const size_t i = static_cast<size_t>(index);
+    if (i >= ruleNs.size()) {
+        ruleNs.resize(i + 1, 0);
+        ruleTypes.resize(i + 1, nullptr);
+        ruleNames.resize(i + 1);
+    }
+    // Keyed on the dynamic type rather than the address: a reset may put a
+    // different rule at the address of a deleted one.
+    const std::type_info& type = typeid(rule);
+    if (!ruleTypes[i] || *ruleTypes[i] != type) {
+        ruleTypes[i] = &type;
+        ruleNames[i] = ruleName(rule);
+    }
+    ruleNs[i] = elapsedNs(start, end);
+    rulesThisStep = std::max(rulesThisStep, i + 1);
+
+    if (trace)
+        traceEvent(ruleNames[i].c_str(), "rule", start, end);
+}
+
+void StepProfiler::publish(SharedStats* stats) const {
+    if (!stats) return;
+
+    stats->sequence.fetch_add(1, std::memory_order_acq_rel);  // odd: write in progress
+
+    stats->step = static_cast<int>(step);
+    stats->stepNs = stepNs;
+    std::copy(std::begin(phaseNs), std::end(phaseNs), stats->phaseNs);
+
+    const int count = std::min(static_cast<int>(ruleNs.size()), MAX_PROFILED_RULES);
+    stats->ruleCount = count;
+    for (int i = 0; i < count; ++i) {
+        stats->ruleNs[i] = ruleNs[i];
+        std::strncpy(stats->ruleNames[i], ruleNames[i].c_str(), MAX_RULE_NAME - 1);
+        stats->ruleNames[i][MAX_RULE_NAME - 1] = '\0';
+    }
+
+    stats->agentCount = agentCount;
+    stats->publishedBytes = publishedBytes;
+    stats->allocations = allocationTrackingEnabled() ? allocations.count : -1;
+    stats->allocatedBytes = allocationTrackingEnabled() ? allocations.bytes : -1;
+
+    stats->sequence.fetch_add(1, std::memory_order_release);  // even: consistent
+}
+
+bool StepProfiler::startTrace(const char* path) {
+    stopTrace();
+    trace = fopen(path, "w");
+    if (!trace) {
+        perror("fopen (trace)");
+        return false;
+    }
+    fprintf(trace, "{\"traceEvents\":[\n");
+    firstTraceEvent = true;
+    traceOrigin = Clock::now();
+    return true;
+}
+
+void StepProfiler::stopTrace() {
+    if (!trace) return;
+    fprintf(trace, "\n]}\n");
+    fclose(trace);
+    trace = nullptr;
+}
+
+void StepProfiler::traceEvent(const char* name, const char* category,
+                              Clock::time_point start, Clock::time_point end) {
+    // Complete ("X") events with microsecond timestamps relative to startTrace().
+    fprintf(trace, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                   "\"pid\":%d,\"tid\":0,\"args\":{\"step\":%lld}}",
+            firstTraceEvent ? "" : ",\n", name, category,
+            elapsedNs(traceOrigin, start) / 1000.0, elapsedNs(start, end) / 1000.0,
+            static_cast<int>(getpid()), step);
+    firstTraceEvent = false;
+}
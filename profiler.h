@@ -0,0 +1,97 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <typeinfo>
+#include <vector>
+#include "uglylab_sharedmemory.h"
+
+class Rule;
+
+// Heap allocation counters. They only move when the library is built with
+// UGLYLAB_TRACK_ALLOCATIONS, which replaces the global operator new.
+struct AllocationStats {
+    long long count;
+    long long bytes;
+};
+bool allocationTrackingEnabled();
+AllocationStats allocationStats();
+
+// Records per-phase and per-rule timings of one simulation step. The numbers
+// of the last completed step can be published to a SharedStats block and,
+// optionally, every step is appended to a Chrome trace (chrome://tracing,
+// ui.perfetto.dev) for offline analysis.
+class StepProfiler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    ~StepProfiler();
+
+    void beginStep(long long step);
+    void endStep();
+
+    void beginPhase(StepPhase phase);
+    void endPhase(StepPhase phase);
+
+    Clock::time_point now() const { return Clock::now(); }
+    void recordRule(int index, const Rule& rule, Clock::time_point start);
+
+    void setAgentCount(long long count) { agentCount = count; }
+    void addPublishedBytes(long long bytes) { publishedBytes += bytes; }
+
+    void publish(SharedStats* stats) const;
+
+    // Call from the stepping thread only, between steps; Simulator::startTrace()
+    // forwards requests from other threads there.
+    bool startTrace(const char* path);
+    void stopTrace();
+
+    long long lastStepNs() const { return stepNs; }
+    long long lastPhaseNs(StepPhase phase) const { return phaseNs[phase]; }
+
+private:
+    long long step = 0;
+    Clock::time_point stepStart;
+    Clock::time_point phaseStart[PHASE_COUNT];
+    long long stepNs = 0;
+    long long phaseNs[PHASE_COUNT] = {};
+
+    // Rules timed by the last step, by execution index. Trimmed to the rules
+    // that actually ran, so rules removed by a reset are not published.
+    std::vector<long long> ruleNs;
+    std::vector<const std::type_info*> ruleTypes;  // type seen at each index, to refresh cached names
+    std::vector<std::string> ruleNames;
+    size_t rulesThisStep = 0;
+
+    long long agentCount = 0;
+    long long publishedBytes = 0;
+    AllocationStats allocationsAtStart = {0, 0};
+    AllocationStats allocations = {0, 0};
+
+    FILE* trace = nullptr;
+    bool firstTraceEvent = true;
+    Clock::time_point traceOrigin;
+
+    void traceEvent(const char* name, const char* category,
+                    Clock::time_point start, Clock::time_point end);
+};
+
+// Times a phase for the lifetime of the scope; no-op without a profiler.
+class ProfileScope {
+public:
+    ProfileScope(StepProfiler* profiler, StepPhase phase)
+        : profiler(profiler), phase(phase) {
+        if (profiler) profiler->beginPhase(phase);
+    }
+    ~ProfileScope() {
+        if (profiler) profiler->endPhase(phase);
+    }
+
+private:
+    StepProfiler* profiler;
+    StepPhase phase;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,208 @@
+#ifndef REDUCTIONS_H
+#define REDUCTIONS_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "grid3d.h"
+#include "observables.h"
+#include "parallel.h"
+#include "species.h"
+
+// Parallel statistics over grid cells and agent attributes, for rules that
+// report per-step observables:
+//
+//   const Summary s = summarize(*world.asGrid<float>());
+//   world.observe("total_mass", s.sum);
+//   world.observe("max_concentration", s.max);
+//   world.getObservables().setHistogram("concentration", histogram(*grid, 32, 0.0, 1.0));
+//   world.observe("cells", summarizeAgents<Cell>([](const Cell& c) { return c.volume; }).count);
+//
+// Each worker reduces one contiguous block with a plain loop over the data
+// the compiler can vectorize, and the partials are merged in block order,
+// so results are reproducible for a given thread count.
+
+struct Summary {
+    size_t count = 0;
+    double sum = 0.0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    double mean = 0.0;
+    double m2 = 0.0;  // sum of squared deviations from the mean
+
+    double variance() const { return count > 0 ? m2 / count : 0.0; }  // population variance
+    double stddev() const { return std::sqrt(variance()); }
+
+    // Chan et al. pairwise merge of two partial summaries.
+    void merge(const Summary& other) {
+        if (other.count == 0) return;
+        if (count == 0) {
+            *this = other;
+            return;
+        }
+        const double n = static_cast<double>(count + other.count);
+        const double delta = other.mean - mean;
+        mean += delta * other.count / n;
+        m2 += other.m2 + delta * delta * count * other.count / n;
+        sum += other.sum;
+        count += other.count;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+};
+
+namespace reduction_detail {
+
+// Summary of value(i) for i in [begin, end). Deviations are accumulated
+// from the block's first value, which keeps the one-pass variance accurate
+// for fields with a large offset.
+template<typename Value>
+Summary summarizeBlock(size_t begin, size_t end, Value&& value) {
+    Summary s;
+    if (begin >= end) return s;
+    const double shift = value(begin);
+    double sum = 0.0, d1 = 0.0, d2 = 0.0;
+    double lo = shift, hi = shift;
+    for (size_t i = begin; i < end; ++i) {
+        const double v = value(i);
+        const double d = v - shift;
+        sum += v;
+        d1 += d;
+        d2 += d * d;
+        lo = std::min(lo, v);
+        hi = std::max(hi, v);
+    }
+    s.count = end - begin;
+    s.sum = sum;
+    s.min = lo;
+    s.max = hi;
+    s.mean = shift + d1 / s.count;
+    s.m2 = std::max(0.0, d2 - d1 * d1 / s.count);
+    return s;
+}
+
+template<typename Value>
+Summary summarize(size_t n, Value&& value) {
+    return parallelReduce(0, n, Summary(),
+                          [&](size_t begin, size_t end, Summary& partial) {
+                              partial.merge(summarizeBlock(begin, end, value));
+                          },
+                          [](Summary& into, const Summary& from) { into.merge(from); },
+                          4096);
+}
+
+template<typename Value>
+Histogram histogram(size_t n, int bins, double lo, double hi, Value&& value) {
+    Histogram identity;
+    identity.lo = lo;
+    identity.hi = hi;
+    identity.counts.assign(std::max(bins, 1), 0);
+    const double scale = hi > lo ? identity.counts.size() / (hi - lo) : 0.0;
+
+    return parallelReduce(0, n, identity,
+                          [&](size_t begin, size_t end, Histogram& h) {
+                              const long long last = static_cast<long long>(h.counts.size()) - 1;
+                              for (size_t i = begin; i < end; ++i) {
+                                  const double v = value(i);
+                                  if (!(v >= lo)) {  // also catches NaN
+                                      ++h.underflow;
+                                  } else if (v >= hi) {
+                                      ++h.overflow;
+                                  } else {
+                                      const long long b = static_cast<long long>((v - lo) * scale);
+                                      ++h.counts[std::min(b, last)];
+                                  }
+                              }
+                          },
+                          [](Histogram& into, const Histogram& from) {
+                              for (size_t b = 0; b < into.counts.size(); ++b)
+                                  into.counts[b] += from.counts[b];
+                              into.underflow += from.underflow;
+                              into.overflow += from.overflow;
+                          },
+                          4096);
+}
+
+template<typename Pred>
+size_t countIf(size_t n, Pred&& pred) {
+    return parallelReduce(size_t(0), n, size_t(0),
+                          [&](size_t begin, size_t end, size_t& count) {
+                              size_t c = 0;
+                              for (size_t i = begin; i < end; ++i)
+                                  c += pred(i) ? 1 : 0;
+                              count += c;
+                          },
+                          [](size_t& into, const size_t& from) { into += from; },
+                          4096);
+}
+
+} // namespace reduction_detail
+
+// ---------- Grids ----------
+
+template<typename T, int X, int Y, int Z>
+Summary summarize(const Grid3D<T, X, Y, Z>& grid) {
+    const T* data = grid.rawData();
+    return reduction_detail::summarize(grid.getTotalSize(),
+                                       [data](size_t i) { return static_cast<double>(data[i]); });
+}
+
+template<typename T, int X, int Y, int Z>
+double sum(const Grid3D<T, X, Y, Z>& grid) {
+    const T* data = grid.rawData();
+    return parallelReduce(size_t(0), grid.getTotalSize(), 0.0,
+                          [data](size_t begin, size_t end, double& total) {
+                              double s = 0.0;
+                              for (size_t i = begin; i < end; ++i)
+                                  s += data[i];
+                              total += s;
+                          },
+                          [](double& into, const double& from) { into += from; },
+                          4096);
+}
+
+// Histogram of the cell values with `bins` equal bins over [lo, hi).
+template<typename T, int X, int Y, int Z>
+Histogram histogram(const Grid3D<T, X, Y, Z>& grid, int bins, double lo, double hi) {
+    const T* data = grid.rawData();
+    return reduction_detail::histogram(grid.getTotalSize(), bins, lo, hi,
+                                       [data](size_t i) { return static_cast<double>(data[i]); });
+}
+
+// Number of cells for which pred(value) holds.
+template<typename T, int X, int Y, int Z, typename Pred>
+size_t countIf(const Grid3D<T, X, Y, Z>& grid, Pred&& pred) {
+    const T* data = grid.rawData();
+    return reduction_detail::countIf(grid.getTotalSize(), [&](size_t i) { return pred(data[i]); });
+}
+
+// ---------- Species attributes ----------
+// `attribute(const Derived&)` returns the value to reduce, e.g. an energy
+// member or a coordinate of the position.
+
+template<typename Derived, typename Attribute>
+Summary summarizeAgents(Attribute&& attribute) {
+    const std::vector<Derived*>& agents = Species<Derived>::agents;
+    return reduction_detail::summarize(agents.size(), [&](size_t i) {
+        return static_cast<double>(attribute(static_cast<const Derived&>(*agents[i])));
+    });
+}
+
+template<typename Derived, typename Attribute>
+Histogram histogramAgents(Attribute&& attribute, int bins, double lo, double hi) {
+    const std::vector<Derived*>& agents = Species<Derived>::agents;
+    return reduction_detail::histogram(agents.size(), bins, lo, hi, [&](size_t i) {
+        return static_cast<double>(attribute(static_cast<const Derived&>(*agents[i])));
+    });
+}
+
+template<typename Derived, typename Pred>
+size_t countAgentsIf(Pred&& pred) {
+    const std::vector<Derived*>& agents = Species<Derived>::agents;
+    return reduction_detail::countIf(agents.size(), [&](size_t i) {
+        return pred(static_cast<const Derived&>(*agents[i]));
+    });
+}
+
+#endif // REDUCTIONS_H
@@ -1,24 +1,76 @@
 #include "simulator.h"
 #include "uglylab_sharedmemory.h"
+#include "agentlod.h"
+#include "fieldstore.h"
 #include <QThread>
 
 // Global shared memory instance
 static CommandBuffer* cmd = attachCommandBuffer();
 static SharedBuffer* shm = attachSharedBuffer();
+static SharedStats* stats = attachSharedStats();
 
 static int grid_shm_fd = -1;
 static void* grid_shm_ptr = nullptr;
 
+static void* field_shm_ptr[MAX_PUBLISHED_FIELDS] = {};
+static size_t field_shm_size[MAX_PUBLISHED_FIELDS] = {};
+
+// List the world's fields in the command buffer so the viewer can pick some.
+static void describeFields(const FieldStore& fields) {
+    const int count = std::min(fields.fieldCount(), MAX_PUBLISHED_FIELDS);
+    if (fields.fieldCount() > MAX_PUBLISHED_FIELDS)
+        fprintf(stderr, "⚠️ Only the first %d fields can be published\n", MAX_PUBLISHED_FIELDS);
+
+    cmd->fieldX.store(fields.getXSize());
+    cmd->fieldY.store(fields.getYSize());
+    cmd->fieldZ.store(fields.getZSize());
+    cmd->fieldCellSize.store(fields.getCellSize());
+    for (int i = 0; i < count; ++i) {
+        std::strncpy(cmd->fields[i].name, fields.fieldName(i).c_str(), MAX_FIELD_NAME - 1);
+        cmd->fields[i].name[MAX_FIELD_NAME - 1] = '\0';
+        cmd->fields[i].type = fields.fieldType(i);
+    }
+    cmd->fieldCount.store(count);
+}
+
+// Late binding, as for the grid: attach a field once the viewer created its segment.
+static void attachReadyFields(const FieldStore& fields) {
+    const unsigned int ready = cmd->fieldReadyMask.load();
+    const int count = std::min(fields.fieldCount(), MAX_PUBLISHED_FIELDS);
+    for (int i = 0; i < count; ++i) {
+        if (!(ready & (1u << i)) || field_shm_ptr[i]) continue;
+
+        const std::string name = fieldShmName(i);
+        field_shm_ptr[i] = fields.fieldType(i) == GRID_TYPE_INT
+                               ? static_cast<void*>(attachSharedGrid<int>(name.c_str()))
+                               : static_cast<void*>(attachSharedGrid<float>(name.c_str()));
+        if (!field_shm_ptr[i]) {
+            fprintf(stderr, "❌ Failed to attach to field '%s' shared memory\n", fields.fieldName(i).c_str());
+            cmd->fieldReadyMask.fetch_and(~(1u << i));
+            continue;
+        }
+        field_shm_size[i] = fields.getRequiredSharedMemorySize(i);
+    }
+}
+
 Simulator::Simulator(World& w)
     : running(false), stepCount(0), world(w) {
+    world.setProfiler(&profiler);
 }
 
 Simulator::~Simulator() {
     stop();
+    world.setProfiler(nullptr);
     if (grid_shm_ptr && grid_shm_fd != -1) {
         munmap(grid_shm_ptr, world.getGrid()->getRequiredSharedMemorySize());
         close(grid_shm_fd);
     }
+    for (int i = 0; i < MAX_PUBLISHED_FIELDS; ++i) {
+        if (field_shm_ptr[i]) {
+            munmap(field_shm_ptr[i], field_shm_size[i]);
+            field_shm_ptr[i] = nullptr;
+        }
+    }
 
 }
 
@@ -34,6 +86,41 @@ void Simulator::stop() {
     running = false;
 }
 
+void Simulator::startTrace(const char* path) {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    requestedTracePath = path ? path : "";
+    traceRequested = true;
+}
+
+void Simulator::stopTrace() {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    requestedTracePath.clear();
+    traceRequested = true;
+}
+
+void Simulator::applyTraceRequest() {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    if (!traceRequested) return;
+    traceRequested = false;
+    if (requestedTracePath.empty())
+        profiler.stopTrace();
+    else
+        profiler.startTrace(requestedTracePath.c_str());
+}
+
+bool Simulator::setSubdomain(const Subdomain& d) {
+    const int rank = simulatorRank();
+    // Without UGLYLAB_RANK the process only publishes as a single rank.
+    if (rank < 0 ? d.rankCount != 1 : d.rank != rank) {
+        fprintf(stderr, "❌ Subdomain of rank %d/%d set on a simulator running as rank %d (UGLYLAB_RANK)\n",
+                d.rank, d.rankCount, rank);
+        return false;
+    }
+    subdomain = d;
+    decomposed = true;
+    return true;
+}
+
 void Simulator::step(int n) {
     for (int i = 0; i < n; ++i) {
         step();
@@ -46,6 +133,19 @@ int Simulator::runSimulation() {
         return 1;
     }
 
+    if (decomposed) {
+        cmd->rankIndex.store(subdomain.rank);
+        cmd->rankCount.store(subdomain.rankCount);
+        cmd->gridOffsetX.store(subdomain.offset[0]);
+        cmd->gridOffsetY.store(subdomain.offset[1]);
+        cmd->gridOffsetZ.store(subdomain.offset[2]);
+        cmd->gridHalo.store(subdomain.halo);
+    }
+
+    if (world.hasFields()) {
+        describeFields(*world.getFields());
+    }
+
     if (world.hasGrid() && !cmd->gridRequested.load()) {
 
         cmd->gridRequested.store(true);
@@ -54,6 +154,8 @@ int Simulator::runSimulation() {
         cmd->gridY.store(world.getGrid()->getYSize());
         cmd->gridZ.store(world.getGrid()->getZSize());
         cmd->gridCellSize.store(world.getGrid()->getCellSize());
+        cmd->gridLayout.store(world.getGrid()->getLayout());
+        cmd->gridBytes.store(static_cast<long long>(world.getGrid()->getRequiredSharedMemorySize()));
     }
 
 
@@ -61,7 +163,9 @@ int Simulator::runSimulation() {
         // 🌟 Late binding: attach grid only when viewer says "I'm ready"
         if (world.hasGrid() && cmd->gridReady.load() && !grid_shm_ptr) {
             int type = cmd->gridType.load();
-            if (type == GRID_TYPE_INT) {
+            if (world.getGrid()->getLayout() == GRID_LAYOUT_SPARSE) {
+                grid_shm_ptr = attachSharedGridSegment();
+            } else if (type == GRID_TYPE_INT) {
                 grid_shm_ptr = attachSharedGrid<int>();
             } else if (type == GRID_TYPE_FLOAT) {
                 grid_shm_ptr = attachSharedGrid<float>();
@@ -77,6 +181,10 @@ int Simulator::runSimulation() {
             continue;  // Wait for next command
         }
 
+        if (world.hasFields()) {
+            attachReadyFields(*world.getFields());
+        }
+
         if (cmd->command.load() == CMD_STEP) {
             step();
             cmd->command.store(CMD_NONE);
@@ -116,14 +224,67 @@ int Simulator::runSimulation() {
 }
 
 void Simulator::performStepLogic() {
-    world.executeRules();
+    applyTraceRequest();
+    profiler.beginStep(stepCount);
+    {
+        ProfileScope phase(&profiler, PHASE_RULES);
+        world.executeRules();
+    }
     if (shm) {
-        auto agent_snapshot = world.collectAllAgentData();
-        writeAgentsPaged(shm, agent_snapshot, stepCount);
+        std::vector<AgentData> agent_snapshot;
+        {
+            ProfileScope phase(&profiler, PHASE_COLLECT_AGENTS);
+            agent_snapshot = world.collectAllAgentData();
+        }
+        {
+            ProfileScope phase(&profiler, PHASE_PUBLISH_AGENTS);
+            const AgentStreamSettings settings = agentStreamSettings(cmd);
+            float boundsMin[3] = {0.0f, 0.0f, 0.0f};
+            float boundsMax[3] = {0.0f, 0.0f, 0.0f};
+            const bool reduced = settings.budget > 0 && agent_snapshot.size() > static_cast<size_t>(settings.budget);
+            if (settings.format == AGENT_FORMAT_QUANTIZED16 || reduced) {
+                if (world.hasGrid()) {
+                    const Grid* grid = world.getGrid();
+                    const Vec3& origin = grid->getOrigin();
+                    boundsMin[0] = origin.x;
+                    boundsMin[1] = origin.y;
+                    boundsMin[2] = origin.z;
+                    boundsMax[0] = origin.x + grid->getXSize() * grid->getCellSize();
+                    boundsMax[1] = origin.y + grid->getYSize() * grid->getCellSize();
+                    boundsMax[2] = origin.z + grid->getZSize() * grid->getCellSize();
+                } else {
+                    agentBounds(agent_snapshot, boundsMin, boundsMax);
+                }
+            }
+            profiler.addPublishedBytes(writeAgentStream(shm, agent_snapshot, settings, boundsMin, boundsMax, stepCount));
+        }
+        profiler.setAgentCount(static_cast<long long>(agent_snapshot.size()));
+        world.getObservables().writeTo(&shm->observables, static_cast<int>(stepCount));
         if (world.hasGrid() && grid_shm_ptr) {
-            world.getGrid()->writeToMemoryRegion(grid_shm_ptr);
+            ProfileScope phase(&profiler, PHASE_PUBLISH_GRID);
+            const Grid* grid = world.getGrid();
+            GridRegion region;
+            if (gridRegionFromCommand(cmd, grid->getXSize(), grid->getYSize(), grid->getZSize(), region)) {
+                profiler.addPublishedBytes(static_cast<long long>(grid->writeRegionToMemoryRegion(grid_shm_ptr, region)));
+            } else {
+                grid->writeToMemoryRegion(grid_shm_ptr);
+                profiler.addPublishedBytes(static_cast<long long>(grid->getRequiredSharedMemorySize()));
+            }
+        }
+        if (world.hasFields()) {
+            ProfileScope phase(&profiler, PHASE_PUBLISH_GRID);
+            FieldStore& fields = *world.getFields();
+            const unsigned int selected = cmd->fieldPublishMask.load();
+            const int count = std::min(fields.fieldCount(), MAX_PUBLISHED_FIELDS);
+            for (int i = 0; i < count; ++i) {
+                if (!(selected & (1u << i)) || !field_shm_ptr[i]) continue;
+                fields.writeFieldToMemoryRegion(i, field_shm_ptr[i]);
+                profiler.addPublishedBytes(static_cast<long long>(field_shm_size[i]));
+            }
         }
     }
+    profiler.endStep();
+    profiler.publish(stats);
 }
 
 /*void Simulator::step()
@@ -2,8 +2,12 @@
 #define SIMULATOR_H
 
 #include "world.h"
+#include "decomposition.h"
+#include "profiler.h"
 #include <QObject>
 #include <atomic>
+#include <mutex>
+#include <string>
 
 class Simulator : public QObject {
     Q_OBJECT
@@ -11,6 +15,16 @@ private:
     std::atomic<bool> running;
     long long stepCount;
     World& world;
+    StepProfiler profiler;
+    Subdomain subdomain;
+    bool decomposed = false;
+
+    // Trace start/stop requested from another thread, applied by the step
+    // loop between steps so traceEvent() never sees the file closed under it.
+    std::mutex traceMutex;
+    bool traceRequested = false;
+    std::string requestedTracePath;  // empty: stop
+    void applyTraceRequest();
 
 public:
     Simulator(World& w);
@@ -24,6 +38,19 @@ public:
     void step();
     void performStepLogic();
 
+    // Chrome/Perfetto JSON trace of every following step's phases and rules.
+    // Safe to call from any thread while the simulation runs: the request
+    // takes effect before the next step, where open errors are reported.
+    void startTrace(const char* path);
+    void stopTrace();
+    const StepProfiler& getProfiler() const { return profiler; }
+
+    // Piece of a decomposed domain simulated by this process, reported to
+    // the viewer so it can place the published grid and agents. Fails if `d`
+    // belongs to another rank than this process's (UGLYLAB_RANK), since the
+    // segments it publishes to are named after that rank.
+    bool setSubdomain(const Subdomain& d);
+
 };
 
 #endif // SIMULATOR_H
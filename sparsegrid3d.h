@@ -0,0 +1,400 @@
+#ifndef SPARSEGRID3D_H
+#define SPARSEGRID3D_H
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include <sys/statvfs.h>
+#include "grid.h"
+#include "parallel.h"
+#include "vec3.h"
+
+// Published image of a SparseGrid3D: only the allocated bricks. After the
+// header come brickCapacity brick origins (3 ints, in cells) and then the
+// values of the bricks, brickSize^3 each in x-fastest order. Cells outside
+// the first brickCount bricks hold `background`.
+template<typename T>
+struct SharedSparseGrid {
+    int xSize, ySize, zSize;
+    float cellSize;
+    int brickSize;
+    int brickCapacity;
+    int brickCount;
+    int truncated;  // 1 when more bricks were allocated than fit
+    T background;
+};
+
+template<typename T>
+inline size_t sparseGridValuesOffset(int brickCapacity) {
+    const size_t origins = sizeof(SharedSparseGrid<T>) + sizeof(int) * 3 * static_cast<size_t>(brickCapacity);
+    return (origins + 63) & ~static_cast<size_t>(63);
+}
+
+template<typename T>
+inline size_t sparseGridBytes(int brickSize, int brickCapacity) {
+    const size_t brickCells = static_cast<size_t>(brickSize) * brickSize * brickSize;
+    return sparseGridValuesOffset<T>(brickCapacity) + sizeof(T) * brickCells * brickCapacity;
+}
+
+// Bytes free on the tmpfs backing POSIX shared memory, 0 if unknown.
+inline size_t sharedMemoryFreeBytes() {
+    struct statvfs fs;
+    if (statvfs("/dev/shm", &fs) != 0) return 0;
+    return static_cast<size_t>(fs.f_bavail) * fs.f_frsize;
+}
+
+template<typename T>
+inline int* sparseGridOrigins(SharedSparseGrid<T>* grid) {
+    return reinterpret_cast<int*>(reinterpret_cast<char*>(grid) + sizeof(SharedSparseGrid<T>));
+}
+
+template<typename T>
+inline T* sparseGridValues(SharedSparseGrid<T>* grid) {
+    return reinterpret_cast<T*>(reinterpret_cast<char*>(grid) + sparseGridValuesOffset<T>(grid->brickCapacity));
+}
+
+// Sparse grid for large, mostly empty domains. Cells live in 8^3 leaf
+// bricks that are allocated on first write; everything else reads as the
+// background value. Bricks hang off a two-level tree of fixed fan-out, a
+// dense root table of internal nodes covering 128^3 cells each, so a lookup
+// is two shifts and two loads, and a 2048^3 domain costs 32 KB per touched
+// internal node plus 512 values per touched brick.
+//
+// Writing through at() or set() may allocate and must be done from one
+// thread. forEachLeaf()/forEachValue() visit the allocated cells in
+// parallel and may update them in place. For runs of nearby lookups use an
+// Accessor, which remembers the last brick it visited.
+template<typename T>
+class SparseGrid3D : public Grid {
+public:
+    static constexpr int LEAF_LOG2 = 3;
+    static constexpr int LEAF_SIZE = 1 << LEAF_LOG2;                 // cells per leaf edge
+    static constexpr int LEAF_CELLS = LEAF_SIZE * LEAF_SIZE * LEAF_SIZE;
+    static constexpr int NODE_LOG2 = 4;
+    static constexpr int NODE_SIZE = 1 << NODE_LOG2;                 // leaves per internal node edge
+    static constexpr int NODE_LEAVES = NODE_SIZE * NODE_SIZE * NODE_SIZE;
+    static constexpr int NODE_CELL_LOG2 = LEAF_LOG2 + NODE_LOG2;     // cells per node edge, log2
+
+    struct Leaf {
+        int origin[3];  // first cell of the brick
+        T values[LEAF_CELLS];
+    };
+
+    SparseGrid3D(int size, float cellSize = 1.0f, const T& background = T())
+        : SparseGrid3D(size, size, size, cellSize, background) {}
+    SparseGrid3D(int xSize, int ySize, int zSize, float cellSize = 1.0f, const T& background = T())
+        : xSize(xSize), ySize(ySize), zSize(zSize), cellSize(cellSize), background(background) {
+        for (int a = 0; a < 3; ++a) {
+            const int size = a == 0 ? xSize : (a == 1 ? ySize : zSize);
+            rootDims[a] = (size + (1 << NODE_CELL_LOG2) - 1) >> NODE_CELL_LOG2;
+        }
+        root.resize(static_cast<size_t>(rootDims[0]) * rootDims[1] * rootDims[2]);
+        publishCapacity = defaultPublishCapacity();
+    }
+
+    inline bool inBounds(int x, int y, int z) const {
+        return x >= 0 && x < xSize &&
+               y >= 0 && y < ySize &&
+               z >= 0 && z < zSize;
+    }
+
+    // Value of a cell; background for unallocated or out-of-bounds cells.
+    inline T get(int x, int y, int z) const {
+        if (!inBounds(x, y, z)) return background;
+        const Leaf* leaf = findLeaf(x, y, z);
+        return leaf ? leaf->values[leafOffset(x, y, z)] : background;
+    }
+
+    // Reference to a cell, allocating its brick if needed.
+    inline T& at(int x, int y, int z) {
+        return touchLeaf(x, y, z)->values[leafOffset(x, y, z)];
+    }
+
+    // Writes a cell; background writes into unallocated bricks allocate nothing.
+    inline void set(int x, int y, int z, const T& value) {
+        Leaf* leaf = findLeaf(x, y, z);
+        if (!leaf) {
+            if (value == background) return;
+            leaf = touchLeaf(x, y, z);
+        }
+        leaf->values[leafOffset(x, y, z)] = value;
+    }
+
+    bool isAllocated(int x, int y, int z) const {
+        return inBounds(x, y, z) && findLeaf(x, y, z) != nullptr;
+    }
+
+    // Cached lookups for loops that stay within a few bricks (stencils,
+    // agent neighbourhoods). One accessor per thread.
+    class Accessor {
+    public:
+        explicit Accessor(SparseGrid3D& grid) : grid(grid) {}
+
+        T get(int x, int y, int z) {
+            if (!grid.inBounds(x, y, z)) return grid.background;
+            Leaf* leaf = lookup(x, y, z, false);
+            return leaf ? leaf->values[leafOffset(x, y, z)] : grid.background;
+        }
+        T& at(int x, int y, int z) {
+            return lookup(x, y, z, true)->values[leafOffset(x, y, z)];
+        }
+        void set(int x, int y, int z, const T& value) {
+            Leaf* leaf = lookup(x, y, z, false);
+            if (!leaf) {
+                if (value == grid.background) return;
+                leaf = lookup(x, y, z, true);
+            }
+            leaf->values[leafOffset(x, y, z)] = value;
+        }
+
+    private:
+        SparseGrid3D& grid;
+        Leaf* cached = nullptr;
+        int key[3] = {-1, -1, -1};
+
+        Leaf* lookup(int x, int y, int z, bool allocate) {
+            const int kx = x >> LEAF_LOG2, ky = y >> LEAF_LOG2, kz = z >> LEAF_LOG2;
+            if (cached && kx == key[0] && ky == key[1] && kz == key[2])
+                return cached;
+            Leaf* leaf = allocate ? grid.touchLeaf(x, y, z) : grid.findLeaf(x, y, z);
+            if (leaf) {
+                cached = leaf;
+                key[0] = kx;
+                key[1] = ky;
+                key[2] = kz;
+            }
+            return leaf;
+        }
+    };
+
+    Accessor accessor() { return Accessor(*this); }
+
+    template<typename Func>
+    void forEachNeighbor(int x, int y, int z, Func&& func, bool includeCenter = false) const {
+        for (int dz = -1; dz <= 1; ++dz)
+            for (int dy = -1; dy <= 1; ++dy)
+                for (int dx = -1; dx <= 1; ++dx) {
+                    if (!includeCenter && dx == 0 && dy == 0 && dz == 0)
+                        continue;
+
+                    int nx = x + dx;
+                    int ny = y + dy;
+                    int nz = z + dz;
+
+                    if (inBounds(nx, ny, nz))
+                        func(nx, ny, nz, get(nx, ny, nz));
+                }
+    }
+
+    // Calls func(Leaf&) for every allocated brick, in parallel.
+    template<typename Func>
+    void forEachLeaf(Func&& func) {
+        parallelFor(0, leaves.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                func(*leaves[i]);
+        }, 16);
+    }
+
+    // Calls func(x, y, z, T&) for every in-bounds cell of the allocated bricks, in parallel.
+    template<typename Func>
+    void forEachValue(Func&& func) {
+        forEachLeaf([&](Leaf& leaf) {
+            const int x1 = std::min(leaf.origin[0] + LEAF_SIZE, xSize);
+            const int y1 = std::min(leaf.origin[1] + LEAF_SIZE, ySize);
+            const int z1 = std::min(leaf.origin[2] + LEAF_SIZE, zSize);
+            for (int z = leaf.origin[2]; z < z1; ++z)
+                for (int y = leaf.origin[1]; y < y1; ++y)
+                    for (int x = leaf.origin[0]; x < x1; ++x)
+                        func(x, y, z, leaf.values[leafOffset(x, y, z)]);
+        });
+    }
+
+    // Frees the bricks whose cells all hold the background value. Returns the number freed.
+    size_t prune() {
+        std::vector<unsigned char> empty(leaves.size());
+        parallelFor(0, leaves.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                empty[i] = std::all_of(leaves[i]->values, leaves[i]->values + LEAF_CELLS,
+                                       [&](const T& v) { return v == background; });
+        }, 16);
+
+        size_t kept = 0, freed = 0;
+        for (size_t i = 0; i < leaves.size(); ++i) {
+            Leaf* leaf = leaves[i];
+            if (!empty[i]) {
+                leaves[kept++] = leaf;
+                continue;
+            }
+            Node* node = root[rootIndex(leaf->origin[0], leaf->origin[1], leaf->origin[2])].get();
+            node->leaves[nodeIndex(leaf->origin[0], leaf->origin[1], leaf->origin[2])].reset();
+            ++freed;
+        }
+        leaves.resize(kept);
+        return freed;
+    }
+
+    void clear() {
+        leaves.clear();
+        for (auto& node : root) node.reset();
+    }
+
+    const T& getBackground() const { return background; }
+    size_t leafCount() const { return leaves.size(); }
+    const std::vector<Leaf*>& allocatedLeaves() const { return leaves; }
+
+    // Bytes held by the tree, for comparison with a dense Grid3D.
+    size_t memoryUsage() const {
+        size_t nodes = 0;
+        for (const auto& node : root) nodes += node ? 1 : 0;
+        return root.size() * sizeof(root[0]) + nodes * sizeof(Node) + leaves.size() * sizeof(Leaf);
+    }
+
+    // Number of bricks the published segment has room for. Defaults to every
+    // brick of the domain, capped to half of the space free on /dev/shm when
+    // the grid is created: the segment lives on tmpfs, and writing pages past
+    // what tmpfs can back raises SIGBUS instead of failing. Extra bricks are
+    // left out and flagged (SharedSparseGrid::truncated). setPublishCapacity()
+    // overrides the limit; set it before the segment is created.
+    void setPublishCapacity(int bricks) { publishCapacity = std::clamp(bricks, 1, maxBrickCount()); }
+    int getPublishCapacity() const { return publishCapacity; }
+
+    // Bricks needed to cover the whole domain.
+    int maxBrickCount() const {
+        const long long bricks = static_cast<long long>((xSize + LEAF_SIZE - 1) / LEAF_SIZE) *
+                                 ((ySize + LEAF_SIZE - 1) / LEAF_SIZE) * ((zSize + LEAF_SIZE - 1) / LEAF_SIZE);
+        return static_cast<int>(std::clamp<long long>(bricks, 1, std::numeric_limits<int>::max()));
+    }
+
+    // Bricks of the domain that fit in half of the free /dev/shm space, the
+    // rest being left to the agent and field segments.
+    int defaultPublishCapacity() const {
+        const size_t available = sharedMemoryFreeBytes() / 2;
+        const size_t brickBytes = sizeof(T) * LEAF_CELLS + sizeof(int) * 3;
+        const size_t fixed = sparseGridValuesOffset<T>(0);
+        if (available == 0) return maxBrickCount();
+        const size_t bricks = available > fixed ? (available - fixed) / brickBytes : 0;
+        return static_cast<int>(std::clamp<size_t>(bricks, 1, static_cast<size_t>(maxBrickCount())));
+    }
+
+    inline int getXSize() const override { return xSize; }
+    inline int getYSize() const override { return ySize; }
+    inline int getZSize() const override { return zSize; }
+    inline float getCellSize() const override { return cellSize; }
+    void* rawVoidData() override { return nullptr; }  // no contiguous storage
+    GridLayout getLayout() const override { return GRID_LAYOUT_SPARSE; }
+
+    size_t getRequiredSharedMemorySize() const override {
+        return sparseGridBytes<T>(LEAF_SIZE, getPublishCapacity());
+    }
+
+    void writeToMemoryRegion(void* ptr) const override {
+        auto* out = reinterpret_cast<SharedSparseGrid<T>*>(ptr);
+        const int capacity = getPublishCapacity();
+        const size_t count = std::min(leaves.size(), static_cast<size_t>(capacity));
+        if (count < leaves.size() && !warnedTruncated) {
+            fprintf(stderr, "⚠️ Sparse grid has %zu bricks, only %d are published\n", leaves.size(), capacity);
+            warnedTruncated = true;
+        }
+
+        out->xSize = xSize;
+        out->ySize = ySize;
+        out->zSize = zSize;
+        out->cellSize = cellSize;
+        out->brickSize = LEAF_SIZE;
+        out->brickCapacity = capacity;
+        out->brickCount = static_cast<int>(count);
+        out->truncated = count < leaves.size() ? 1 : 0;
+        out->background = background;
+
+        int* origins = sparseGridOrigins(out);
+        T* values = sparseGridValues(out);
+        parallelFor(0, count, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                std::memcpy(&origins[3 * i], leaves[i]->origin, sizeof(int) * 3);
+                std::memcpy(&values[i * LEAF_CELLS], leaves[i]->values, sizeof(T) * LEAF_CELLS);
+            }
+        }, 64);
+    }
+
+    GridDataType getType() const override {
+        if constexpr (std::is_same_v<T, int>) return GRID_TYPE_INT;
+        if constexpr (std::is_same_v<T, float>) return GRID_TYPE_FLOAT;
+        if constexpr (std::is_same_v<T, bool>) return GRID_TYPE_BOOL;
+        return static_cast<GridDataType>(-1);  // unsupported
+    }
+
+    // World position of the corner of cell (0,0,0), as for Grid3D.
+    void setOrigin(const Vec3& o) { origin = o; }
+    const Vec3& getOrigin() const override { return origin; }
+
+    // Convert from grid indices (i,j,k) to world coordinates
+    Vec3 toWorldCoordinates(int i, int j, int k) const {
+        return Vec3{origin.x + (i + 0.5f) * cellSize, origin.y + (j + 0.5f) * cellSize,
+                    origin.z + (k + 0.5f) * cellSize};
+    }
+
+    // Convert from world coordinates (x,y,z) to grid indices (i,j,k)
+    Vec3 fromWorldPosition(float x, float y, float z) const {
+        return Vec3(std::floor((x - origin.x) / cellSize), std::floor((y - origin.y) / cellSize),
+                    std::floor((z - origin.z) / cellSize));
+    }
+
+private:
+    struct Node {
+        std::unique_ptr<Leaf> leaves[NODE_LEAVES];
+    };
+
+    int xSize, ySize, zSize;
+    float cellSize;
+    Vec3 origin;
+    T background;
+    int rootDims[3];
+    std::vector<std::unique_ptr<Node>> root;
+    std::vector<Leaf*> leaves;  // allocation order, for parallel sweeps and publishing
+    int publishCapacity;
+    mutable bool warnedTruncated = false;
+
+    static inline int leafOffset(int x, int y, int z) {
+        constexpr int mask = LEAF_SIZE - 1;
+        return (x & mask) | ((y & mask) << LEAF_LOG2) | ((z & mask) << (2 * LEAF_LOG2));
+    }
+    inline size_t rootIndex(int x, int y, int z) const {
+        return static_cast<size_t>(x >> NODE_CELL_LOG2) + static_cast<size_t>(rootDims[0]) *
+               ((y >> NODE_CELL_LOG2) + static_cast<size_t>(rootDims[1]) * (z >> NODE_CELL_LOG2));
+    }
+    static inline int nodeIndex(int x, int y, int z) {
+        constexpr int mask = NODE_SIZE - 1;
+        return ((x >> LEAF_LOG2) & mask) | (((y >> LEAF_LOG2) & mask) << NODE_LOG2) |
+               (((z >> LEAF_LOG2) & mask) << (2 * NODE_LOG2));
+    }
+
+    inline Leaf* findLeaf(int x, int y, int z) const {
+        const Node* node = root[rootIndex(x, y, z)].get();
+        return node ? node->leaves[nodeIndex(x, y, z)].get() : nullptr;
+    }
+
+    Leaf* touchLeaf(int x, int y, int z) {
+        assert(inBounds(x, y, z));
+        std::unique_ptr<Node>& node = root[rootIndex(x, y, z)];
+        if (!node) node.reset(new Node());
+        std::unique_ptr<Leaf>& leaf = node->leaves[nodeIndex(x, y, z)];
+        if (!leaf) {
+            leaf.reset(new Leaf());
+            leaf->origin[0] = x & ~(LEAF_SIZE - 1);
+            leaf->origin[1] = y & ~(LEAF_SIZE - 1);
+            leaf->origin[2] = z & ~(LEAF_SIZE - 1);
+            std::fill(leaf->values, leaf->values + LEAF_CELLS, background);
+            leaves.push_back(leaf.get());
+        }
+        return leaf.get();
+    }
+};
+
+#endif // SPARSEGRID3D_H
@@ -12,7 +12,7 @@ private:
     static bool registered;
 
 public:
-    Vec3* position;
+    Vec3* position = nullptr;
     static std::vector<Derived*> agents;
 
     static void addAgents(int numAgents, const std::vector<std::function<float()>>& distributions) {
@@ -24,9 +24,32 @@ public:
         }
     }
 
+    // Bulk callbacks handed to the world's species registry. They access
+    // `position` and `SpeciesID` directly, so the loops carry no virtual calls.
+    static void snapshotAgents(std::vector<AgentData>& out) {
+        for (const Derived* agent : agents) {
+            const Vec3* pos = agent->position;
+            if (pos) {
+                out.push_back({pos->x, pos->y, pos->z, Derived::SpeciesID});
+            }
+        }
+    }
+
+    static void clearAgents() {
+        std::vector<Derived*> temp;
+        temp.swap(agents);
+        for (Derived* agent : temp) {
+            delete agent;
+        }
+    }
+
+    static size_t agentCount() {
+        return agents.size();
+    }
+
     Species(){
         if (!registered) {
-            World::context()->registerSpecies(&agents);
+            World::context()->registerSpecies({&snapshotAgents, &clearAgents, &agentCount});
             registered = true;
         }
         agents.push_back(static_cast<Derived*>(this));
@@ -0,0 +1,278 @@
+#include "transport.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+constexpr int TRANSPORT_MAGIC = 0x55474c59;  // "UGLY"
+constexpr int CONNECT_TIMEOUT_MS = 30000;
+constexpr int PEER_TIMEOUT_MS = 120000;  // barrier/exchange with no progress from the peers
+
+struct ShmTransport::Header {
+    std::atomic<int> ready;  // TRANSPORT_MAGIC once rank 0 has initialized the segment
+    pid_t creator;           // rank 0 of the run that owns the segment
+    int rankCount;
+    size_t mailboxCapacity;
+    std::atomic<int> barrierArrived;
+    std::atomic<int> barrierGeneration;
+};
+
+struct ShmTransport::Mailbox {
+    std::atomic<int> full;  // 1 while a fragment waits for the receiver
+    int last;               // 1 on the final fragment of a message
+    size_t bytes;           // payload of this fragment, stored right after the mailbox
+};
+
+static size_t alignTo64(size_t n) {
+    return (n + 63) & ~static_cast<size_t>(63);
+}
+
+// Spins briefly, then yields, then sleeps, so idle ranks don't burn a core.
+static void backoff(int& idle) {
+    if (++idle < 64) return;
+    if (idle < 256) {
+        std::this_thread::yield();
+        return;
+    }
+    usleep(50);
+}
+
+static long long elapsedMs(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+// True if the segment mapped from `fd` is the one currently published under
+// `name` and was created by a live process (creator 0: not written yet). A segment left by a crashed run
+// fails one of the two: rank 0 of the new run unlinks it and creates a new
+// one, and until it does, the old creator is gone.
+static bool isCurrentSegment(const char* name, int fd, pid_t creator) {
+    if (creator > 0 && kill(creator, 0) == -1 && errno == ESRCH) return false;
+
+    struct stat mapped, published;
+    const int current = shm_open(name, O_RDONLY, 0);
+    if (current == -1) return false;
+    const bool same = fstat(fd, &mapped) == 0 && fstat(current, &published) == 0 &&
+                      mapped.st_dev == published.st_dev && mapped.st_ino == published.st_ino;
+    close(current);
+    return same;
+}
+
+ShmTransport* ShmTransport::connect(const char* job, int rank, int rankCount, size_t mailboxCapacity) {
+    if (rankCount < 1 || rank < 0 || rank >= rankCount || mailboxCapacity == 0) {
+        fprintf(stderr, "Invalid transport rank %d of %d\n", rank, rankCount);
+        return nullptr;
+    }
+
+    ShmTransport* t = new ShmTransport();
+    t->name = std::string("/uglylab_transport_") + job;
+    t->myRank = rank;
+    t->rankCount = rankCount;
+    t->capacity = mailboxCapacity;
+    t->mailboxStride = alignTo64(sizeof(Mailbox) + mailboxCapacity);
+    t->segmentSize = alignTo64(sizeof(Header)) +
+                     t->mailboxStride * static_cast<size_t>(rankCount) * rankCount;
+
+    if (rank == 0) {
+        shm_unlink(t->name.c_str());  // drop a segment left over by a crashed run
+        const int fd = shm_open(t->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+        if (fd == -1 || ftruncate(fd, t->segmentSize) == -1) {
+            perror("shm_open/ftruncate (transport)");
+            if (fd != -1) close(fd);
+            delete t;
+            return nullptr;
+        }
+        void* ptr = mmap(nullptr, t->segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED) {
+            perror("mmap (transport)");
+            delete t;
+            return nullptr;
+        }
+        t->segment = ptr;
+
+        Header* h = t->header();
+        h->creator = getpid();
+        h->rankCount = rankCount;
+        h->mailboxCapacity = mailboxCapacity;
+        h->barrierArrived.store(0);
+        h->barrierGeneration.store(0);
+        for (int from = 0; from < rankCount; ++from)
+            for (int to = 0; to < rankCount; ++to)
+                t->mailbox(from, to)->full.store(0);
+        h->ready.store(TRANSPORT_MAGIC, std::memory_order_release);
+    } else if (!t->attach()) {
+        delete t;
+        return nullptr;
+    }
+
+    if (!t->barrier()) {  // every rank is attached before anyone sends
+        delete t;
+        return nullptr;
+    }
+    return t;
+}
+
+bool ShmTransport::attach() {
+    const auto start = std::chrono::steady_clock::now();
+    bool staleReported = false;
+    while (true) {
+        if (elapsedMs(start) >= CONNECT_TIMEOUT_MS) {
+            fprintf(stderr, "Timed out waiting for rank 0 to initialize %s\n", name.c_str());
+            return false;
+        }
+
+        const int fd = shm_open(name.c_str(), O_RDWR, 0666);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < segmentSize) {
+            if (fd != -1) close(fd);  // not created or not sized yet
+            usleep(10000);
+            continue;
+        }
+
+        void* ptr = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) {
+            perror("mmap (transport)");
+            close(fd);
+            return false;
+        }
+        segment = ptr;
+
+        // Wait for rank 0 to finish, as long as this is still its segment.
+        Header* h = header();
+        bool current = isCurrentSegment(name.c_str(), fd, h->creator);
+        for (int polls = 1; current && h->ready.load(std::memory_order_acquire) != TRANSPORT_MAGIC; ++polls) {
+            if (elapsedMs(start) >= CONNECT_TIMEOUT_MS) break;
+            usleep(1000);
+            if (polls % 10 == 0)
+                current = isCurrentSegment(name.c_str(), fd, h->creator);
+        }
+        if (current && h->ready.load(std::memory_order_acquire) == TRANSPORT_MAGIC)
+            current = isCurrentSegment(name.c_str(), fd, h->creator);  // creator is set by now
+        close(fd);
+
+        if (current && h->ready.load(std::memory_order_acquire) == TRANSPORT_MAGIC) {
+            if (h->rankCount != rankCount || h->mailboxCapacity != capacity) {
+                fprintf(stderr, "Transport %s was created for %d ranks / %zu bytes, expected %d / %zu\n",
+                        name.c_str(), h->rankCount, h->mailboxCapacity, rankCount, capacity);
+                return false;
+            }
+            return true;
+        }
+        if (current)
+            continue;  // timed out, reported at the top of the loop
+
+        if (!staleReported) {
+            fprintf(stderr, "⚠️ Ignoring stale transport segment %s, waiting for rank 0\n", name.c_str());
+            staleReported = true;
+        }
+        munmap(segment, segmentSize);
+        segment = nullptr;
+        usleep(10000);
+    }
+}
+
+ShmTransport::~ShmTransport() {
+    if (segment) {
+        munmap(segment, segmentSize);
+        if (myRank == 0)
+            shm_unlink(name.c_str());
+    }
+}
+
+ShmTransport::Header* ShmTransport::header() const {
+    return static_cast<Header*>(segment);
+}
+
+ShmTransport::Mailbox* ShmTransport::mailbox(int from, int to) const {
+    char* base = static_cast<char*>(segment) + alignTo64(sizeof(Header));
+    return reinterpret_cast<Mailbox*>(base + mailboxStride * (static_cast<size_t>(from) * rankCount + to));
+}
+
+bool ShmTransport::exchange(int sendTo, const void* data, size_t bytes,
+                            int receiveFrom, std::vector<char>& received) {
+    if (sendTo >= rankCount || receiveFrom >= rankCount) {
+        fprintf(stderr, "Transport rank out of range (%d, %d)\n", sendTo, receiveFrom);
+        return false;
+    }
+
+    received.clear();
+    const char* src = static_cast<const char*>(data);
+    size_t sent = 0;
+    bool sendDone = sendTo < 0;
+    bool receiveDone = receiveFrom < 0;
+    int idle = 0;
+    auto lastProgress = std::chrono::steady_clock::now();
+
+    while (!sendDone || !receiveDone) {
+        bool progress = false;
+
+        if (!sendDone) {
+            Mailbox* box = mailbox(myRank, sendTo);
+            if (box->full.load(std::memory_order_acquire) == 0) {
+                const size_t n = std::min(capacity, bytes - sent);
+                if (n > 0)
+                    std::memcpy(reinterpret_cast<char*>(box + 1), src + sent, n);
+                sent += n;
+                box->bytes = n;
+                box->last = sent == bytes ? 1 : 0;
+                sendDone = box->last == 1;
+                box->full.store(1, std::memory_order_release);
+                progress = true;
+            }
+        }
+
+        if (!receiveDone) {
+            Mailbox* box = mailbox(receiveFrom, myRank);
+            if (box->full.load(std::memory_order_acquire) == 1) {
+                const char* payload = reinterpret_cast<const char*>(box + 1);
+                received.insert(received.end(), payload, payload + box->bytes);
+                receiveDone = box->last == 1;
+                box->full.store(0, std::memory_order_release);
+                progress = true;
+            }
+        }
+
+        if (progress) {
+            idle = 0;
+            lastProgress = std::chrono::steady_clock::now();
+        } else {
+            backoff(idle);
+            if (idle > 256 && elapsedMs(lastProgress) >= PEER_TIMEOUT_MS) {
+                fprintf(stderr, "❌ Transport exchange with ranks %d/%d timed out on rank %d\n",
+                        sendTo, receiveFrom, myRank);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool ShmTransport::barrier() {
+    Header* h = header();
+    const int generation = h->barrierGeneration.load(std::memory_order_acquire);
+    if (h->barrierArrived.fetch_add(1, std::memory_order_acq_rel) + 1 == rankCount) {
+        h->barrierArrived.store(0, std::memory_order_relaxed);
+        h->barrierGeneration.fetch_add(1, std::memory_order_release);
+        return true;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    int idle = 0;
+    while (h->barrierGeneration.load(std::memory_order_acquire) == generation) {
+        backoff(idle);
+        if (idle > 256 && elapsedMs(start) >= PEER_TIMEOUT_MS) {
+            fprintf(stderr, "❌ Transport barrier timed out on rank %d (%d of %d ranks arrived)\n",
+                    myRank, h->barrierArrived.load(std::memory_order_relaxed), rankCount);
+            return false;
+        }
+    }
+    return true;
+}
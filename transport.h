@@ -0,0 +1,69 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Message passing between the simulator processes of a decomposed run.
+class Transport {
+public:
+    virtual ~Transport() = default;
+
+    virtual int rank() const = 0;
+    virtual int size() const = 0;
+
+    // Sends `bytes` bytes to rank `sendTo` while receiving one message from
+    // rank `receiveFrom` into `received`; either rank may be -1 to skip that
+    // half. Both halves progress together, so pairwise exchanges in opposite
+    // directions cannot deadlock. Returns false on transport failure, including
+    // a peer that makes no progress for a long time (crashed or hung).
+    virtual bool exchange(int sendTo, const void* data, size_t bytes,
+                          int receiveFrom, std::vector<char>& received) = 0;
+
+    // Blocks until every rank has called barrier(). Returns false if the other
+    // ranks do not arrive in time; the transport is unusable after that.
+    virtual bool barrier() = 0;
+};
+
+// Transport over one POSIX shared memory segment holding a mailbox for every
+// ordered pair of ranks. Messages larger than a mailbox are streamed through
+// it in fragments. All ranks must run on the same host.
+class ShmTransport : public Transport {
+public:
+    // Rank 0 creates the segment "/uglylab_transport_<job>", the other ranks
+    // wait for it to appear. A segment with that name left by a crashed run is
+    // recognised (its creator is gone or the name now points to a new segment)
+    // and skipped. Use a job name unique to the run. Returns nullptr on failure.
+    static ShmTransport* connect(const char* job, int rank, int rankCount,
+                                 size_t mailboxCapacity = 1 << 20);
+    ~ShmTransport() override;
+
+    int rank() const override { return myRank; }
+    int size() const override { return rankCount; }
+
+    bool exchange(int sendTo, const void* data, size_t bytes,
+                  int receiveFrom, std::vector<char>& received) override;
+    bool barrier() override;
+
+private:
+    ShmTransport() = default;
+
+    struct Header;
+    struct Mailbox;
+
+    bool attach();  // ranks > 0: map rank 0's segment of this run
+
+    Header* header() const;
+    Mailbox* mailbox(int from, int to) const;
+
+    std::string name;
+    int myRank = 0;
+    int rankCount = 0;
+    size_t capacity = 0;
+    size_t mailboxStride = 0;
+    size_t segmentSize = 0;
+    void* segment = nullptr;
+};
+
+#endif // TRANSPORT_H
@@ -3,24 +3,76 @@
 
 
 #include "grid3d.h"
+#include "memorypolicy.h"
+#include "sparsegrid3d.h"
+#include <algorithm>
 #include <atomic>
+#include <cerrno>
+#include <cstdint>
 #include <cstring>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <cstdio>
+#include <cstdlib>
+#include <string>
 #include <vector>
 
+// ---------- Segment names ----------
+// In a decomposed run (see decomposition.h) every simulator process publishes
+// its own set of segments, suffixed with its rank: "/uglylab_shm.r2". The
+// simulator takes its rank from the UGLYLAB_RANK environment variable; the
+// viewer passes the rank of the piece it opens.
+inline int simulatorRank() {
+    static const int rank = [] {
+        const char* env = std::getenv("UGLYLAB_RANK");
+        return env ? std::atoi(env) : -1;
+    }();
+    return rank;
+}
+
+inline std::string rankedShmName(const char* base, int rank) {
+    if (rank < 0) return base;
+    return std::string(base) + ".r" + std::to_string(rank);
+}
+
 // ---------- Agent data ----------
 struct AgentData {
     float x, y, z;
     int species_id;
 };
 
+// Compact agent record: position quantized to 16 bits per axis relative to
+// the frame bounds (AgentFrameInfo). How many agents a record stands for is
+// given per frame (AgentFrameInfo::record_weight) or, for aggregated frames,
+// per record in a weight array after each chunk's records (chunkWeights).
+struct QuantizedAgentData {
+    uint16_t x, y, z;
+    uint16_t species_id;
+};
+static_assert(sizeof(QuantizedAgentData) == 8, "QuantizedAgentData must stay 8 bytes");
+
+enum AgentFormat {
+    AGENT_FORMAT_FLOAT = 0,         // AgentData records
+    AGENT_FORMAT_QUANTIZED16 = 1    // QuantizedAgentData records
+};
+
+enum AgentLodMode {
+    AGENT_LOD_SUBSAMPLE = 0,    // spatially stratified subset of the agents
+    AGENT_LOD_AGGREGATE = 1     // one record per occupied coarse cell and species
+};
+
 // ---------- Command buffer ----------
 constexpr const char* CMD_SHM_NAME = "/uglylab_cmd";
 
+enum GridRoiMode {
+    ROI_FULL = 0,    // whole grid
+    ROI_SLICE = 1,   // one plane across roiAxis at roiSlice
+    ROI_BOX = 2      // sub-box roiMin..roiMax
+};
+
 enum CommandType {
     CMD_NONE = 0,
     CMD_START,
@@ -31,6 +83,14 @@ enum CommandType {
     CMD_INITIALIZE //run one step at start (just to fill buffers), without incrementing step count
 };
 
+constexpr int MAX_PUBLISHED_FIELDS = 32;
+constexpr int MAX_FIELD_NAME = 32;
+
+struct FieldDescriptor {
+    char name[MAX_FIELD_NAME];
+    int type;  // GridDataType
+};
+
 struct CommandBuffer {
     std::atomic<int> command;
 
@@ -39,10 +99,72 @@ struct CommandBuffer {
     std::atomic<int> gridX, gridY, gridZ;
     std::atomic<float> gridCellSize;
     std::atomic<bool> gridReady;   // viewer will set this to true
+
+    // Agent stream requested by the viewer (all zero = full float stream).
+    std::atomic<int> agentFormat;      // AgentFormat
+    std::atomic<int> agentLodBudget;   // max records per frame, 0 = unlimited
+    std::atomic<int> agentLodMode;     // AgentLodMode, used when over budget
+
+    // Piece of a decomposed domain published by this simulator (rankCount 0 = whole domain).
+    std::atomic<int> rankIndex, rankCount;
+    std::atomic<int> gridOffsetX, gridOffsetY, gridOffsetZ;  // global index of the first interior cell
+    std::atomic<int> gridHalo;                               // ghost layers around the published grid
+
+    // Named fields of the world's FieldStore, listed by the simulator.
+    std::atomic<int> fieldCount;
+    std::atomic<int> fieldX, fieldY, fieldZ;
+    std::atomic<float> fieldCellSize;
+    FieldDescriptor fields[MAX_PUBLISHED_FIELDS];
+    std::atomic<unsigned int> fieldPublishMask;  // viewer: bit i = publish field i every step
+    std::atomic<unsigned int> fieldReadyMask;    // viewer: bit i = segment of field i exists
+
+    // Shared layout of the grid segment; sparse grids need gridBytes bytes.
+    std::atomic<int> gridLayout;        // GridLayout
+    std::atomic<long long> gridBytes;
+
+    // Region of the grid the viewer wants each step (GridRoiMode); the
+    // simulator clamps it to the grid and publishes only those cells.
+    std::atomic<int> roiMode;
+    std::atomic<int> roiAxis, roiSlice;                // ROI_SLICE: axis 0..2 and cell index
+    std::atomic<int> roiMinX, roiMinY, roiMinZ;        // ROI_BOX: cells [min, max)
+    std::atomic<int> roiMaxX, roiMaxY, roiMaxZ;
+    std::atomic<int> roiStride;                        // keep every n-th cell, 0/1 = all
 };
 
+// Region requested by the viewer, clamped to a x*y*z grid. Returns false
+// for ROI_FULL or an empty request, in which case the whole grid is published.
+inline bool gridRegionFromCommand(const CommandBuffer* cmd, int x, int y, int z, GridRegion& region) {
+    const int mode = cmd ? cmd->roiMode.load() : ROI_FULL;
+    if (mode != ROI_SLICE && mode != ROI_BOX) return false;
+
+    const int dims[3] = {x, y, z};
+    int lo[3] = {0, 0, 0};
+    int hi[3] = {x, y, z};
+    if (mode == ROI_SLICE) {
+        const int axis = cmd->roiAxis.load();
+        if (axis < 0 || axis > 2) return false;
+        lo[axis] = std::clamp(cmd->roiSlice.load(), 0, dims[axis] - 1);
+        hi[axis] = lo[axis] + 1;
+    } else {
+        const int mins[3] = {cmd->roiMinX.load(), cmd->roiMinY.load(), cmd->roiMinZ.load()};
+        const int maxs[3] = {cmd->roiMaxX.load(), cmd->roiMaxY.load(), cmd->roiMaxZ.load()};
+        for (int a = 0; a < 3; ++a) {
+            lo[a] = std::clamp(mins[a], 0, dims[a]);
+            hi[a] = std::clamp(maxs[a], lo[a], dims[a]);
+        }
+    }
+
+    region.stride = std::max(1, cmd->roiStride.load());
+    for (int a = 0; a < 3; ++a) {
+        region.offset[a] = lo[a];
+        region.size[a] = (hi[a] - lo[a] + region.stride - 1) / region.stride;
+        if (region.size[a] <= 0) return false;
+    }
+    return true;
+}
+
 inline CommandBuffer* attachCommandBuffer() {
-    int fd = shm_open(CMD_SHM_NAME, O_RDWR, 0666);
+    int fd = shm_open(rankedShmName(CMD_SHM_NAME, simulatorRank()).c_str(), O_RDWR, 0666);
     if (fd == -1) {
         perror("shm_open (sim command)");
         return nullptr;
@@ -57,8 +179,8 @@ inline CommandBuffer* attachCommandBuffer() {
     return static_cast<CommandBuffer*>(ptr);
 }
 
-inline CommandBuffer* openOrCreateCommandBuffer() {
-    int fd = shm_open(CMD_SHM_NAME, O_CREAT | O_RDWR, 0666);
+inline CommandBuffer* openOrCreateCommandBuffer(int rank = -1) {
+    int fd = shm_open(rankedShmName(CMD_SHM_NAME, rank).c_str(), O_CREAT | O_RDWR, 0666);
     if (fd == -1) {
         perror("shm_open (viewer command)");
         return nullptr;
@@ -88,6 +210,11 @@ constexpr const char* SHM_NAME = "/uglylab_shm";
 constexpr int MAX_CHUNK_SIZE = 4096;
 constexpr int MAX_CHUNKS_PER_FRAME = 10000;
 constexpr int NUM_BUFFERS = 2;
+constexpr int MAX_QUANTIZED_CHUNK_SIZE =
+    static_cast<int>(MAX_CHUNK_SIZE * sizeof(AgentData) / sizeof(QuantizedAgentData));
+// Records per chunk when each one is followed by a uint32_t weight.
+constexpr int MAX_WEIGHTED_CHUNK_SIZE =
+    static_cast<int>(MAX_CHUNK_SIZE * sizeof(AgentData) / (sizeof(QuantizedAgentData) + sizeof(uint32_t)));
 
 struct AgentChunk {
     std::atomic<int> ready;
@@ -95,17 +222,66 @@ struct AgentChunk {
     int chunk_index;
     int total_chunks;
     int agents_in_chunk;
-    AgentData agents[MAX_CHUNK_SIZE];
+    union {  // interpreted according to AgentFrameInfo::format
+        AgentData agents[MAX_CHUNK_SIZE];
+        QuantizedAgentData quantized[MAX_QUANTIZED_CHUNK_SIZE];
+    };
+};
+
+// Weights of a weighted quantized chunk, stored right after its records.
+inline uint32_t* chunkWeights(AgentChunk& chunk) {
+    return reinterpret_cast<uint32_t*>(chunk.quantized + chunk.agents_in_chunk);
+}
+inline const uint32_t* chunkWeights(const AgentChunk& chunk) {
+    return reinterpret_cast<const uint32_t*>(chunk.quantized + chunk.agents_in_chunk);
+}
+
+struct AgentFrameInfo {
+    int format;            // AgentFormat of the chunks in this buffer
+    int total_agents;      // population before LOD reduction
+    int published_agents;  // records actually written
+    int weighted;          // 1: per-record weights follow each chunk's records (chunkWeights)
+    float record_weight;   // agents per record, total_agents / published_agents
+    float bounds_min[3];   // quantization bounds (AGENT_FORMAT_QUANTIZED16 only)
+    float bounds_max[3];
+};
+
+constexpr int MAX_OBSERVABLES = 64;
+constexpr int MAX_OBSERVABLE_NAME = 32;
+constexpr int MAX_OBSERVED_HISTOGRAMS = 4;
+constexpr int MAX_HISTOGRAM_BINS = 64;
+
+struct ObservedHistogram {
+    char name[MAX_OBSERVABLE_NAME];
+    double lo, hi;          // range covered by the bins
+    int binCount;
+    long long underflow, overflow;
+    long long counts[MAX_HISTOGRAM_BINS];
+};
+
+// Scalars and histograms recorded by the rules during the last step (see
+// Observables). Written under the same sequence protocol as SharedStats:
+// odd while the simulator writes, retry the copy if it changed.
+struct StepObservables {
+    std::atomic<unsigned int> sequence;
+    int step;
+    int count;
+    char names[MAX_OBSERVABLES][MAX_OBSERVABLE_NAME];
+    double values[MAX_OBSERVABLES];
+    int histogramCount;
+    ObservedHistogram histograms[MAX_OBSERVED_HISTOGRAMS];
 };
 
 struct SharedBuffer {
     std::atomic<int> currentStep;
     std::atomic<int> visible_buffer_index;
     AgentChunk buffers[NUM_BUFFERS][MAX_CHUNKS_PER_FRAME];
+    AgentFrameInfo frame_info[NUM_BUFFERS];
+    StepObservables observables;
 };
 
 inline SharedBuffer* attachSharedBuffer() {
-    int fd = shm_open(SHM_NAME, O_RDWR, 0666);
+    int fd = shm_open(rankedShmName(SHM_NAME, simulatorRank()).c_str(), O_RDWR, 0666);
     if (fd == -1) {
         perror("shm_open (sim shared)");
         return nullptr;
@@ -116,12 +292,16 @@ inline SharedBuffer* attachSharedBuffer() {
         perror("mmap (sim shared)");
         return nullptr;
     }
+    adviseHugePages(ptr, sizeof(SharedBuffer));
 
     return static_cast<SharedBuffer*>(ptr);
 }
 
-inline void writeAgentsPaged(SharedBuffer* buffer, const std::vector<AgentData>& allAgents, int frame_index) {
-    if (!buffer) return;
+// `totalAgents` is the population the records were reduced from (-1: all of them).
+// Returns false if nothing was published.
+inline bool writeAgentsPaged(SharedBuffer* buffer, const std::vector<AgentData>& allAgents, int frame_index,
+                             int totalAgents = -1) {
+    if (!buffer) return false;
 
     const int write_index = 1 - buffer->visible_buffer_index.load();
     AgentChunk* chunks = buffer->buffers[write_index];
@@ -131,7 +311,7 @@ inline void writeAgentsPaged(SharedBuffer* buffer, const std::vector<AgentData>&
 
     if (total_chunks > MAX_CHUNKS_PER_FRAME) {
         fprintf(stderr, "Too many agents (%zu), max allowed is %d\n", total, MAX_CHUNK_SIZE * MAX_CHUNKS_PER_FRAME);
-        return;
+        return false;
     }
 
     size_t offset = 0;
@@ -151,11 +331,108 @@ inline void writeAgentsPaged(SharedBuffer* buffer, const std::vector<AgentData>&
         offset += count;
     }
 
+    AgentFrameInfo& info = buffer->frame_info[write_index];
+    info.format = AGENT_FORMAT_FLOAT;
+    info.total_agents = totalAgents < 0 ? static_cast<int>(total) : totalAgents;
+    info.published_agents = static_cast<int>(total);
+    info.weighted = 0;
+    info.record_weight = total > 0 ? static_cast<float>(info.total_agents) / total : 1.0f;
+
     buffer->visible_buffer_index.store(write_index);
+    return true;
 }
 
-inline SharedBuffer* openOrCreateSharedBuffer() {
-    int fd = shm_open(SHM_NAME, O_CREAT | O_RDWR, 0666);
+inline uint16_t quantizeCoordinate(float v, float lo, float scale) {
+    const float q = (v - lo) * scale + 0.5f;
+    if (!(q > 0.0f)) return 0;  // also catches NaN
+    if (q >= 65535.0f) return 65535;
+    return static_cast<uint16_t>(q);
+}
+
+// Writes the agents as QuantizedAgentData relative to [boundsMin, boundsMax].
+// `totalAgents` is the population the records were reduced from. With
+// `weights` empty every record stands for record_weight agents; otherwise
+// the frame is weighted and each chunk holds at most MAX_WEIGHTED_CHUNK_SIZE
+// records followed by their weights. Returns false if nothing was published.
+inline bool writeAgentsQuantizedPaged(SharedBuffer* buffer, const std::vector<AgentData>& allAgents,
+                                      const std::vector<uint32_t>& weights,
+                                      const float boundsMin[3], const float boundsMax[3],
+                                      int frame_index, int totalAgents) {
+    if (!buffer) return false;
+
+    const int write_index = 1 - buffer->visible_buffer_index.load();
+    AgentChunk* chunks = buffer->buffers[write_index];
+
+    const size_t total = allAgents.size();
+    const bool weighted = !weights.empty();
+    const size_t perChunk = weighted ? MAX_WEIGHTED_CHUNK_SIZE : MAX_QUANTIZED_CHUNK_SIZE;
+    const int total_chunks = static_cast<int>((total + perChunk - 1) / perChunk);
+
+    if (total_chunks > MAX_CHUNKS_PER_FRAME) {
+        fprintf(stderr, "Too many agents (%zu), max allowed is %zu\n", total, perChunk * MAX_CHUNKS_PER_FRAME);
+        return false;
+    }
+
+    float scale[3];
+    for (int a = 0; a < 3; ++a) {
+        const float extent = boundsMax[a] - boundsMin[a];
+        scale[a] = extent > 0.0f ? 65535.0f / extent : 0.0f;
+    }
+
+    size_t offset = 0;
+    for (int i = 0; i < total_chunks; ++i) {
+        size_t count = std::min(perChunk, total - offset);
+        AgentChunk& chunk = chunks[i];
+
+        chunk.ready.store(0);
+        chunk.frame_index = frame_index;
+        chunk.chunk_index = i;
+        chunk.total_chunks = total_chunks;
+        chunk.agents_in_chunk = static_cast<int>(count);
+
+        for (size_t k = 0; k < count; ++k) {
+            const AgentData& in = allAgents[offset + k];
+            QuantizedAgentData& out = chunk.quantized[k];
+            out.x = quantizeCoordinate(in.x, boundsMin[0], scale[0]);
+            out.y = quantizeCoordinate(in.y, boundsMin[1], scale[1]);
+            out.z = quantizeCoordinate(in.z, boundsMin[2], scale[2]);
+            out.species_id = static_cast<uint16_t>(in.species_id);
+        }
+        if (weighted)
+            std::memcpy(chunkWeights(chunk), weights.data() + offset, count * sizeof(uint32_t));
+        chunk.ready.store(1);
+
+        offset += count;
+    }
+
+    AgentFrameInfo& info = buffer->frame_info[write_index];
+    info.format = AGENT_FORMAT_QUANTIZED16;
+    info.total_agents = totalAgents;
+    info.published_agents = static_cast<int>(total);
+    info.weighted = weighted ? 1 : 0;
+    info.record_weight = total > 0 ? static_cast<float>(totalAgents) / total : 1.0f;
+    for (int a = 0; a < 3; ++a) {
+        info.bounds_min[a] = boundsMin[a];
+        info.bounds_max[a] = boundsMax[a];
+    }
+
+    buffer->visible_buffer_index.store(write_index);
+    return true;
+}
+
+// Viewer side: position of a quantized record in world coordinates.
+inline AgentData dequantizeAgent(const QuantizedAgentData& q, const AgentFrameInfo& info) {
+    const float unit = 1.0f / 65535.0f;
+    return {
+        info.bounds_min[0] + q.x * unit * (info.bounds_max[0] - info.bounds_min[0]),
+        info.bounds_min[1] + q.y * unit * (info.bounds_max[1] - info.bounds_min[1]),
+        info.bounds_min[2] + q.z * unit * (info.bounds_max[2] - info.bounds_min[2]),
+        q.species_id
+    };
+}
+
+inline SharedBuffer* openOrCreateSharedBuffer(int rank = -1) {
+    int fd = shm_open(rankedShmName(SHM_NAME, rank).c_str(), O_CREAT | O_RDWR, 0666);
     if (fd == -1) {
         perror("shm_open (viewer shared)");
         return nullptr;
@@ -174,6 +451,7 @@ inline SharedBuffer* openOrCreateSharedBuffer() {
         close(fd);
         return nullptr;
     }
+    adviseHugePages(ptr, size);
 
     auto* buffer = static_cast<SharedBuffer*>(ptr);
     buffer->visible_buffer_index.store(0);
@@ -185,14 +463,88 @@ inline SharedBuffer* openOrCreateSharedBuffer() {
     return buffer;
 }
 
+// ---------- Step statistics ----------
+constexpr const char* STATS_SHM_NAME = "/uglylab_stats";
+constexpr int MAX_PROFILED_RULES = 64;
+constexpr int MAX_RULE_NAME = 64;
+
+enum StepPhase {
+    PHASE_RULES = 0,
+    PHASE_COLLECT_AGENTS,
+    PHASE_PUBLISH_AGENTS,
+    PHASE_PUBLISH_GRID,
+    PHASE_COUNT
+};
+
+// Timings of the last completed step. The simulator bumps `sequence` to an
+// odd value before writing and to an even value afterwards; a reader copies
+// the block and retries if the sequence was odd or changed meanwhile.
+struct SharedStats {
+    std::atomic<unsigned int> sequence;
+    int step;
+    long long stepNs;
+    long long phaseNs[PHASE_COUNT];
+    int ruleCount;                      // rules beyond MAX_PROFILED_RULES are not reported
+    long long ruleNs[MAX_PROFILED_RULES];
+    char ruleNames[MAX_PROFILED_RULES][MAX_RULE_NAME];
+    long long agentCount;
+    long long publishedBytes;
+    long long allocations;              // -1 when built without UGLYLAB_TRACK_ALLOCATIONS
+    long long allocatedBytes;
+};
+
+inline SharedStats* openOrCreateSharedStats(int rank = -1) {
+    int fd = shm_open(rankedShmName(STATS_SHM_NAME, rank).c_str(), O_CREAT | O_RDWR, 0666);
+    if (fd == -1) {
+        perror("shm_open (viewer stats)");
+        return nullptr;
+    }
+
+    if (ftruncate(fd, sizeof(SharedStats)) == -1) {
+        perror("ftruncate (stats)");
+        close(fd);
+        return nullptr;
+    }
+
+    void* ptr = mmap(nullptr, sizeof(SharedStats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        perror("mmap (viewer stats)");
+        close(fd);
+        return nullptr;
+    }
+
+    auto* stats = static_cast<SharedStats*>(ptr);
+    stats->sequence.store(0);
+    return stats;
+}
+
+inline SharedStats* attachSharedStats() {
+    int fd = shm_open(rankedShmName(STATS_SHM_NAME, simulatorRank()).c_str(), O_RDWR, 0666);
+    if (fd == -1) {
+        // The stats block is optional: viewers that don't show it never create it.
+        if (errno != ENOENT)
+            perror("shm_open (sim stats)");
+        return nullptr;
+    }
+
+    void* ptr = mmap(nullptr, sizeof(SharedStats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        perror("mmap (sim stats)");
+        return nullptr;
+    }
+
+    return static_cast<SharedStats*>(ptr);
+}
+
 // ---------- Grid buffer ----------
 constexpr const char* GRID_SHM_NAME = "/uglylab_grid";
 
 template<typename T>
-SharedGrid<T>* openOrCreateSharedGrid(int x, int y, int z, float cellSize = 1.0f) {
+SharedGrid<T>* openOrCreateSharedGrid(int x, int y, int z, float cellSize = 1.0f, int rank = -1,
+                                      const char* name = GRID_SHM_NAME) {
     const size_t gridSize = sizeof(SharedGrid<T>) + sizeof(T) * x * y * z;
 
-    int fd = shm_open(GRID_SHM_NAME, O_CREAT | O_RDWR, 0666);
+    int fd = shm_open(rankedShmName(name, rank).c_str(), O_CREAT | O_RDWR, 0666);
     if (fd == -1) {
         perror("shm_open (viewer grid)");
         return nullptr;
@@ -210,33 +562,108 @@ SharedGrid<T>* openOrCreateSharedGrid(int x, int y, int z, float cellSize = 1.0f
         close(fd);
         return nullptr;
     }
+    adviseHugePages(ptr, gridSize);
 
     auto* grid = static_cast<SharedGrid<T>*>(ptr);
+    setSharedGridHeader(grid, x, y, z, cellSize);
+
+    // Optional: zero-initialize grid data
+    std::memset(grid->data, 0, sizeof(T) * x * y * z);
+
+    return grid;
+}
+
+// Segment of a SparseGrid3D, sized by the simulator (CommandBuffer::gridBytes).
+template<typename T>
+SharedSparseGrid<T>* openOrCreateSharedSparseGrid(int x, int y, int z, float cellSize, size_t bytes,
+                                                  int rank = -1, const char* name = GRID_SHM_NAME) {
+    int fd = shm_open(rankedShmName(name, rank).c_str(), O_CREAT | O_RDWR, 0666);
+    if (fd == -1) {
+        perror("shm_open (viewer sparse grid)");
+        return nullptr;
+    }
+
+    if (ftruncate(fd, bytes) == -1) {
+        perror("ftruncate (sparse grid)");
+        close(fd);
+        return nullptr;
+    }
+
+    void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        perror("mmap (sparse grid)");
+        return nullptr;
+    }
+    adviseHugePages(ptr, bytes);
+
+    auto* grid = static_cast<SharedSparseGrid<T>*>(ptr);
     grid->xSize = x;
     grid->ySize = y;
     grid->zSize = z;
     grid->cellSize = cellSize;
+    grid->brickSize = 0;
+    grid->brickCapacity = 0;
+    grid->brickCount = 0;  // nothing published yet
+    grid->truncated = 0;
+    grid->background = T();
+    return grid;
+}
 
-    // Optional: zero-initialize grid data
-    std::memset(grid->data, 0, sizeof(T) * x * y * z);
+// Maps an existing grid segment whole, whatever its layout.
+inline void* attachSharedGridSegment(const char* name = GRID_SHM_NAME) {
+    int fd = shm_open(rankedShmName(name, simulatorRank()).c_str(), O_RDWR, 0666);
+    if (fd == -1) {
+        perror("shm_open (sim grid)");
+        return nullptr;
+    }
 
-    return grid;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat (grid)");
+        close(fd);
+        return nullptr;
+    }
+
+    void* ptr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        perror("mmap (grid)");
+        return nullptr;
+    }
+    adviseHugePages(ptr, st.st_size);
+    return ptr;
 }
 
-inline void* createGridBufferFromCommand(const CommandBuffer* cmd) {
+inline void* createGridBufferFromCommand(const CommandBuffer* cmd, int rank = -1) {
     int type = cmd->gridType.load();
     int x = cmd->gridX.load();
     int y = cmd->gridY.load();
     int z = cmd->gridZ.load();
     float cellSize = cmd->gridCellSize.load();
 
+    if (cmd->gridLayout.load() == GRID_LAYOUT_SPARSE) {
+        const size_t bytes = static_cast<size_t>(cmd->gridBytes.load());
+        switch (type) {
+        case GRID_TYPE_INT:
+            return openOrCreateSharedSparseGrid<int>(x, y, z, cellSize, bytes, rank);
+        case GRID_TYPE_FLOAT:
+            return openOrCreateSharedSparseGrid<float>(x, y, z, cellSize, bytes, rank);
+        case GRID_TYPE_BOOL:
+            return openOrCreateSharedSparseGrid<bool>(x, y, z, cellSize, bytes, rank);
+        default:
+            fprintf(stderr, "Unsupported grid type: %d\n", type);
+            return nullptr;
+        }
+    }
+
     switch (type) {
     case GRID_TYPE_INT:
-        return openOrCreateSharedGrid<int>(x, y, z, cellSize);
+        return openOrCreateSharedGrid<int>(x, y, z, cellSize, rank);
     case GRID_TYPE_FLOAT:
-        return openOrCreateSharedGrid<float>(x, y, z, cellSize);
+        return openOrCreateSharedGrid<float>(x, y, z, cellSize, rank);
     case GRID_TYPE_BOOL:
-        return openOrCreateSharedGrid<bool>(x, y, z, cellSize);
+        return openOrCreateSharedGrid<bool>(x, y, z, cellSize, rank);
     default:
         fprintf(stderr, "Unsupported grid type: %d\n", type);
         return nullptr;
@@ -245,8 +672,8 @@ inline void* createGridBufferFromCommand(const CommandBuffer* cmd) {
 
 
 template<typename T>
-SharedGrid<T>* attachSharedGrid() {
-    int fd = shm_open(GRID_SHM_NAME, O_RDWR, 0666);
+SharedGrid<T>* attachSharedGrid(const char* name = GRID_SHM_NAME) {
+    int fd = shm_open(rankedShmName(name, simulatorRank()).c_str(), O_RDWR, 0666);
     if (fd == -1) {
         perror("shm_open (sim grid)");
         return nullptr;
@@ -271,13 +698,42 @@ SharedGrid<T>* attachSharedGrid() {
         close(fd);
         return nullptr;
     }
+    adviseHugePages(ptr, gridSize);
 
     return static_cast<SharedGrid<T>*>(ptr);
 }
 
+// ---------- Field buffers ----------
+// Fields of a FieldStore are published one segment each, "/uglylab_field<i>",
+// with the SharedGrid<T> layout. The simulator lists the fields in
+// CommandBuffer::fields; the viewer creates the segments of the fields it
+// wants, sets their bits in fieldReadyMask and selects what is written each
+// step with fieldPublishMask.
+inline std::string fieldShmName(int index) {
+    return "/uglylab_field" + std::to_string(index);
+}
+
+inline void* createFieldBufferFromCommand(const CommandBuffer* cmd, int index, int rank = -1) {
+    const std::string name = fieldShmName(index);
+    const int x = cmd->fieldX.load();
+    const int y = cmd->fieldY.load();
+    const int z = cmd->fieldZ.load();
+    const float cellSize = cmd->fieldCellSize.load();
+
+    switch (cmd->fields[index].type) {
+    case GRID_TYPE_INT:
+        return openOrCreateSharedGrid<int>(x, y, z, cellSize, rank, name.c_str());
+    case GRID_TYPE_FLOAT:
+        return openOrCreateSharedGrid<float>(x, y, z, cellSize, rank, name.c_str());
+    default:
+        fprintf(stderr, "Unsupported field type: %d\n", cmd->fields[index].type);
+        return nullptr;
+    }
+}
+
 // Write a Grid3D<T> into shared memory
-template<typename T>
-bool writeGridToSharedMemory(const char* shm_name, const Grid3D<T>& grid) {
+template<typename T, int X, int Y, int Z>
+bool writeGridToSharedMemory(const char* shm_name, const Grid3D<T, X, Y, Z>& grid) {
     const size_t headerSize = sizeof(SharedGrid<T>);
     const size_t totalSize = headerSize + grid.getTotalSize() * sizeof(T);
 
@@ -299,14 +755,9 @@ bool writeGridToSharedMemory(const char* shm_name, const Grid3D<T>& grid) {
         close(fd);
         return false;
     }
+    adviseHugePages(ptr, totalSize);
 
-    auto* shared = static_cast<SharedGrid<T>*>(ptr);
-    shared->xSize = grid.getXSize();
-    shared->ySize = grid.getYSize();
-    shared->zSize = grid.getZSize();
-    shared->cellSize = grid.getCellSize();
-
-    std::memcpy(shared->data, grid.rawData(), grid.getTotalSize() * sizeof(T));
+    grid.writeToMemoryRegion(ptr);
 
     munmap(ptr, totalSize);
     close(fd);
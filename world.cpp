@@ -1,5 +1,6 @@
 #include "world.h"
-#include "ispecies.h"
+#include "fieldstore.h"
+#include "profiler.h"
 #include <iostream>
 
 thread_local World* World::currentContext = nullptr;
@@ -8,8 +9,16 @@ World::~World() {
     clear();  // ✅ Ensure proper cleanup
 }
 
-void World::registerSpecies(void* listPtr) {
-    speciesList.push_back(listPtr);
+void World::registerSpecies(const SpeciesEntry& entry) {
+    speciesList.push_back(entry);
+}
+
+size_t World::agentCount() const {
+    size_t total = 0;
+    for (const SpeciesEntry& entry : speciesList) {
+        total += entry.count();
+    }
+    return total;
 }
 
 void World::addRule(Rule* rule) {
@@ -18,8 +27,18 @@ void World::addRule(Rule* rule) {
 
 void World::executeRules() {
     //std::cout << "Executing rules..." << std::endl;
-    for (auto* rule : rules) {
-        rule->execute();
+    observables.beginStep();
+    if (!profiler) {
+        for (auto* rule : rules) {
+            rule->execute();
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < rules.size(); ++i) {
+        const auto start = profiler->now();
+        rules[i]->execute();
+        profiler->recordRule(static_cast<int>(i), *rules[i], start);
     }
 }
 
@@ -32,41 +51,19 @@ void World::clearRules() {
 
 void World::listAllAgents() {
     int i = 1;
-    for (void* listPtr : speciesList) {
-        // Here we assume all agent lists are of std::vector<ISpecies*> type
-        auto agents = static_cast<std::vector<ISpecies*>*>(listPtr);
-
-        for (ISpecies* agent : *agents) {
-            std::cout << "Agent " << i++ << "position: ("
-                      << agent->getVector3D()->x << ", "
-                      << agent->getVector3D()->y << ", "
-                      << agent->getVector3D()->z << ")" << std::endl;
-        }
+    for (const AgentData& agent : collectAllAgentData()) {
+        std::cout << "Agent " << i++ << "position: ("
+                  << agent.x << ", "
+                  << agent.y << ", "
+                  << agent.z << ")" << std::endl;
     }
 }
 
 std::vector<AgentData> World::collectAllAgentData() {
     std::vector<AgentData> agent_snapshot;
-    for (void* listPtr : speciesList) {
-        // All agent lists are std::vector<ISpecies*>*
-
-        auto agents = static_cast<std::vector<ISpecies*>*>(listPtr);
-        if (agents == nullptr) {
-            fprintf(stderr, "  ⚠️ agents is nullptr\n");
-            continue;
-        }
-
-        for (ISpecies* agent : *agents) {
-            auto pos = agent->getVector3D();
-            if (pos) {
-                agent_snapshot.push_back({
-                    pos->x,
-                    pos->y,
-                    pos->z,
-                    agent->getSpeciesID()
-                });
-            }
-        }
+    agent_snapshot.reserve(agentCount());
+    for (const SpeciesEntry& entry : speciesList) {
+        entry.snapshot(agent_snapshot);
     }
     return agent_snapshot;
 }
@@ -78,21 +75,19 @@ void World::clear() {
     // Clear rules
     clearRules();
     // Clear all agents
-    for (void* listPtr : speciesList) {
-        auto* agents = static_cast<std::vector<ISpecies*>*>(listPtr);
-        std::vector<ISpecies*> temp = *agents;
-
-        for (auto* agent : temp) {
-            delete agent;
-        }
-
-        agents->clear();
+    for (const SpeciesEntry& entry : speciesList) {
+        entry.clear();
     }
     //clear grid
     if (grid) {
         delete grid;
         grid = nullptr;
     }
+    if (fields) {
+        delete fields;
+        fields = nullptr;
+    }
+    observables.clear();
 }
 
 void World::reset() {
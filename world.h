@@ -2,8 +2,21 @@
 #define WORLD_H
 #include <vector>
 #include "rule.h"
+#include "observables.h"
 #include "uglylab_sharedmemory.h"
 
+class StepProfiler;
+class FieldStore;
+
+// Bulk operations a species registers with the world. The functions are
+// generated by Species<Derived>, so each one is a tight loop over the typed
+// agent list and the world pays one indirect call per species, not per agent.
+struct SpeciesEntry {
+    void (*snapshot)(std::vector<AgentData>& out);  // append one AgentData per agent
+    void (*clear)();                                // delete every agent of the species
+    size_t (*count)();                              // number of live agents
+};
+
 class World {
     friend class Rule;  // ✅ Give access to Rule
 private:
@@ -11,17 +24,22 @@ private:
 protected:
     std::vector<Rule*> rules;
     Grid* grid = nullptr;  // Pointer to polymorphic grid base    
+    FieldStore* fields = nullptr;  // Named multi-field store, published field by field
     static thread_local World* currentContext;
     bool alreadyCleared = false;
+    StepProfiler* profiler = nullptr;  // set by the Simulator; times each rule when present
+    Observables observables;  // reset by executeRules(), published by the Simulator after every step
 public:
     World() {
         currentContext = this;
     }
-    std::vector<void*> speciesList;
+    std::vector<SpeciesEntry> speciesList;
     static World* context() { return currentContext; }
     virtual ~World();
-    void registerSpecies(void* listPtr);    
+    void registerSpecies(const SpeciesEntry& entry);
+    size_t agentCount() const;
     void executeRules();
+    void setProfiler(StepProfiler* stepProfiler) { profiler = stepProfiler; }
     void clearRules();
     void listAllAgents(); // List all agents in the world (debugging purpose)
     std::vector<AgentData> collectAllAgentData();
@@ -29,11 +47,19 @@ public:
     void clear();
     void reset();
     Grid* getGrid() const { return grid; }
+    template<typename T, int X = 0, int Y = 0, int Z = 0>
+    Grid3D<T, X, Y, Z>* asGrid() const {
+        return static_cast<Grid3D<T, X, Y, Z>*>(grid);
+    }
     template<typename T>
-    Grid3D<T>* asGrid() const {
-        return static_cast<Grid3D<T>*>(grid);
+    SparseGrid3D<T>* asSparseGrid() const {
+        return grid && grid->getLayout() == GRID_LAYOUT_SPARSE ? static_cast<SparseGrid3D<T>*>(grid) : nullptr;
     }
     bool hasGrid() const { return grid != nullptr; }
+    FieldStore* getFields() const { return fields; }
+    bool hasFields() const { return fields != nullptr; }
+    void observe(const std::string& name, double value) { observables.set(name, value); }
+    Observables& getObservables() { return observables; }
 
 };
 